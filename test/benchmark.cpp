@@ -0,0 +1,451 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include "coulombgalore.h"
+
+using namespace CoulombGalore;
+
+/*
+ * Timings of tree-based field evaluation compared to direct summation
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+template <class Function> double seconds(Function f) {
+    auto start = Clock::now();
+    f();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct System {
+    std::vector<vec3> positions, dipoles;
+    std::vector<double> charges;
+
+    System(size_t N, double density = 0.01) {
+        std::mt19937 engine(N);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        double side = std::cbrt(N / density);
+        for (size_t i = 0; i < N; i++) {
+            positions.push_back(side * vec3(uniform(engine), uniform(engine), uniform(engine)));
+            dipoles.push_back(vec3(uniform(engine), uniform(engine), uniform(engine)) - vec3::Constant(0.5));
+            charges.push_back(i % 2 == 0 ? 1.0 : -1.0);
+        }
+    }
+};
+
+template <class Tscheme> std::vector<vec3> brute_force(const Tscheme &pot, const System &system) {
+    const size_t N = system.positions.size();
+    std::vector<vec3> E(N, vec3::Zero());
+    parallel_for(N, std::thread::hardware_concurrency(), [&](size_t i) {
+        for (size_t j = 0; j < N; j++)
+            if (i != j) {
+                vec3 r = system.positions[i] - system.positions[j];
+                E[i] += pot.multipole_field(system.charges[j], system.dipoles[j], mat33::Zero(), r);
+            }
+    });
+    return E;
+}
+
+template <class Tscheme> void treecode(const std::string &name, const Tscheme &pot, double theta) {
+    std::cout << "\n# treecode: " << name << ", theta = " << theta << "\n"
+              << std::setw(8) << "N" << std::setw(12) << "build/s" << std::setw(12) << "query/s" << std::setw(12)
+              << "direct/s" << std::setw(12) << "speedup" << std::setw(12) << "rms error" << "\n";
+    for (size_t N : {1000, 4000, 16000}) {
+        System system(N);
+        TreeCode<Tscheme> tree(pot, theta);
+        std::vector<vec3> E, E_exact;
+        double build = seconds([&] { tree.update(system.positions, system.charges, system.dipoles); });
+        double query = seconds([&] { E = tree.fields(); });
+        double direct = seconds([&] { E_exact = brute_force(pot, system); });
+        double error = 0.0, norm = 0.0;
+        for (size_t i = 0; i < N; i++) {
+            error += (E[i] - E_exact[i]).squaredNorm();
+            norm += E_exact[i].squaredNorm();
+        }
+        std::cout << std::setw(8) << N << std::setw(12) << build << std::setw(12) << query << std::setw(12) << direct
+                  << std::setw(12) << direct / (build + query) << std::setw(12) << std::sqrt(error / norm) << std::endl;
+    }
+}
+
+/*
+ * Crossover of the fast multipole method with direct summation for charges. The first update includes building
+ * the M2L operators, which later updates reuse.
+ */
+template <class Tscheme> void fast_multipole(const std::string &name, const Tscheme &pot, int order) {
+    std::cout << "\n# fast multipole: " << name << ", order = " << order << "\n"
+              << std::setw(8) << "N" << std::setw(8) << "depth" << std::setw(12) << "first/s" << std::setw(12)
+              << "update/s" << std::setw(12) << "direct/s" << std::setw(12) << "speedup" << std::setw(12)
+              << "rms error" << "\n";
+    for (size_t N : {1000, 2000, 4000, 8000, 16000}) {
+        System system(N);
+        FastMultipole<Tscheme> fmm(pot, order);
+        std::vector<vec3> E_exact(N, vec3::Zero());
+        double first = seconds([&] { fmm.update(system.positions, system.charges); });
+        double update = seconds([&] { fmm.update(system.positions, system.charges); });
+        double direct = seconds([&] {
+            parallel_for(N, std::thread::hardware_concurrency(), [&](size_t i) {
+                for (size_t j = 0; j < N; j++)
+                    if (i != j)
+                        E_exact[i] += pot.ion_field(system.charges[j], system.positions[i] - system.positions[j]);
+            });
+        });
+        double error = 0.0, norm = 0.0;
+        for (size_t i = 0; i < N; i++) {
+            error += (fmm.fields()[i] - E_exact[i]).squaredNorm();
+            norm += E_exact[i].squaredNorm();
+        }
+        std::cout << std::setw(8) << N << std::setw(8) << fmm.depth() << std::setw(12) << first << std::setw(12)
+                  << update << std::setw(12) << direct << std::setw(12) << direct / update << std::setw(12)
+                  << std::sqrt(error / norm) << std::endl;
+    }
+}
+
+/*
+ * Time per evaluation of the short-range function and its three derivatives using the combined
+ * erfc/exp evaluation compared to four separate calls
+ */
+template <class Tscheme> void special_functions(const std::string &name, const Tscheme &pot) {
+    const size_t n = 1000000;
+    std::array<double, 4> s, sum = {0, 0, 0, 0}, sum_separate = {0, 0, 0, 0};
+    double time = seconds([&] {
+        for (size_t i = 0; i < n; i++) {
+            pot.template short_range_function_and_derivatives<3>(double(i) / n, s);
+            for (int k = 0; k < 4; k++)
+                sum[k] += s[k];
+        }
+    });
+    double time_separate = seconds([&] {
+        for (size_t i = 0; i < n; i++) {
+            pot.EnergyImplementation<Tscheme, Tscheme::screened>::template short_range_function_and_derivatives<3>(double(i) / n, s);
+            for (int k = 0; k < 4; k++)
+                sum_separate[k] += s[k];
+        }
+    });
+    double difference = 0.0;
+    for (int k = 0; k < 4; k++)
+        difference = std::max(difference, std::fabs(sum[k] - sum_separate[k]) / std::fabs(sum_separate[k]));
+    std::cout << std::setw(12) << name << std::setw(12) << 1e9 * time / n << std::setw(12) << 1e9 * time_separate / n
+              << std::setw(12) << time_separate / time << std::setw(12) << difference << std::endl;
+}
+
+/*
+ * Array evaluation of s(q) and three derivatives through one virtual call, compared to four virtual
+ * calls per distance as done before `short_range_functions()`
+ */
+void batch_functions(const std::string &name, const SchemeBase &pot) {
+    const size_t n = 1000000;
+    std::vector<double> q(n);
+    for (size_t i = 0; i < n; i++)
+        q[i] = double(i) / n;
+    std::array<std::vector<double>, 4> s;
+    for (auto &v : s)
+        v.resize(n);
+    auto batch = [&] { pot.short_range_functions(q.data(), n, s[0].data(), s[1].data(), s[2].data(), s[3].data()); };
+    batch(); // warm up
+    double time = seconds(batch);
+    double difference = 0.0;
+    double time_scalar = seconds([&] {
+        for (size_t i = 0; i < n; i++) {
+            const double d[4] = {pot.short_range_function(q[i]), pot.short_range_function_derivative(q[i]),
+                                 pot.short_range_function_second_derivative(q[i]),
+                                 pot.short_range_function_third_derivative(q[i])};
+            for (int k = 0; k < 4; k++)
+                difference = std::max(difference, std::fabs(d[k] - s[k][i]) / (1.0 + std::fabs(d[k])));
+        }
+    });
+    std::cout << std::setw(12) << name << std::setw(12) << 1e9 * time / n << std::setw(12) << 1e9 * time_scalar / n
+              << std::setw(12) << time_scalar / time << std::setw(12) << difference << std::endl;
+}
+
+/*
+ * Pair evaluation over a Verlet list with a skin at liquid-like density, comparing the plain cutoff
+ * branch and compaction into the pairs inside the cutoff
+ */
+template <class Tscheme> void verlet_list(const std::string &name, const Tscheme &pot, double skin, bool dipoles) {
+    const size_t N = 4000;
+    const double density = 0.03, side = std::cbrt(N / density), range2 = std::pow(pot.cutoff + skin, 2);
+    System system(N, density);
+    OrthorhombicBox box(side);
+    PairDriver<Tscheme, OrthorhombicBox> driver(pot, box);
+    PairList list, inside;
+    for (size_t i = 0; i < N; i++)
+        for (size_t j = i + 1; j < N; j++)
+            if (box.minimum_image(system.positions[j] - system.positions[i]).squaredNorm() < range2)
+                list.push_back({int(i), int(j)});
+    std::shuffle(list.begin(), list.end(), std::mt19937(1)); // as after particles have moved
+    std::vector<vec3> no_dipoles, &mu = dipoles ? system.dipoles : no_dipoles;
+    const int repeat = 5;
+    double branch = 0, compacted = 0, compaction = 0, u = 0;
+    for (int n = 0; n < repeat; n++) {
+        branch += seconds([&] { u += driver.compute(system.positions, system.charges, mu, list).energy; });
+        compaction += seconds([&] { driver.compact(system.positions, list, inside); });
+        compacted += seconds([&] { u += driver.compute(system.positions, system.charges, mu, inside).energy; });
+    }
+    const double beyond = 1.0 - double(inside.size()) / list.size();
+    std::cout << std::setw(12) << name << std::setw(8) << (dipoles ? "yes" : "no") << std::setw(12) << beyond
+              << std::setw(12) << 1e9 * branch / repeat / list.size() << std::setw(12)
+              << 1e9 * compaction / repeat / list.size()
+              << std::setw(12) << 1e9 * compacted / repeat / list.size() << std::endl;
+    volatile double keep = u; // keep results alive
+    (void)keep;
+}
+
+/*
+ * Cluster-pair tiles compared to a compacted pair list at water-like density; ns per pair inside the cutoff
+ */
+template <class Tscheme> void cluster_pairs(const std::string &name, const Tscheme &pot, bool dipoles) {
+    const size_t N = 4000;
+    const double density = 0.1, side = std::cbrt(N / density);
+    System system(N, density);
+    OrthorhombicBox box(side);
+    std::vector<vec3> no_dipoles, &mu = dipoles ? system.dipoles : no_dipoles;
+    PairDriver<Tscheme, OrthorhombicBox> driver(pot, box);
+    auto inside = driver.compact(system.positions, all_pairs(N));
+    ClusterPairDriver<Tscheme, OrthorhombicBox, 4> driver4(pot, box);
+    ClusterPairDriver<Tscheme, OrthorhombicBox, 8> driver8(pot, box);
+    double list = 0, tile4 = 0, tile8 = 0, build4 = 0, build8 = 0;
+    double u = 0;
+    list = seconds([&] { u += driver.compute(system.positions, system.charges, mu, inside).energy; });
+    build4 = seconds([&] { driver4.update(system.positions, system.charges, mu); });
+    tile4 = seconds([&] { u -= driver4.compute().energy; });
+    build8 = seconds([&] { driver8.update(system.positions, system.charges, mu); });
+    tile8 = seconds([&] { u -= driver8.compute().energy; });
+    const double n = inside.size();
+    std::cout << std::setw(12) << name << std::setw(8) << (dipoles ? "yes" : "no") << std::setw(12) << 1e9 * list / n
+              << std::setw(12) << 1e9 * tile4 / n << std::setw(12) << n / (16.0 * driver4.size()) << std::setw(12)
+              << 1e9 * tile8 / n << std::setw(12) << n / (64.0 * driver8.size()) << std::setw(12)
+              << 1e9 * (build4 + build8) / 2 / n << std::endl;
+    volatile double keep = u; // keep results alive
+    (void)keep;
+}
+
+/*
+ * Per-pair virtual dispatch to the same `PairInteraction` kernel that `PairDriver` uses
+ */
+struct VirtualPair {
+    virtual ~VirtualPair() = default;
+    virtual double cutoff() const = 0;
+    virtual PairInteraction interaction(const vec3 &r) const = 0;
+};
+
+template <class Tscheme> struct SchemePair : public VirtualPair {
+    Tscheme pot;
+    SchemePair(const Tscheme &pot) : pot(pot) {}
+    double cutoff() const override { return pot.cutoff; }
+    PairInteraction interaction(const vec3 &r) const override {
+        return pot.template interaction<3>(r, pot.template pair_factors<3>(r.squaredNorm()));
+    }
+};
+
+/*
+ * Ions and dipolar solvent with a scheme per type pair: bucketed `InteractionMatrix` compared to a branch on
+ * the type pair and a virtual call for every pair, both evaluating the same `PairInteraction` per pair
+ */
+void interaction_matrix() {
+    const size_t N = 4000;
+    const double density = 0.1, side = std::cbrt(N / density);
+    System system(N, density);
+    std::vector<int> types(N);
+    for (size_t i = 0; i < N; i++) {
+        types[i] = (i % 10 == 0) ? 0 : 1; // 10% ions, rest neutral dipoles
+        if (types[i] == 1)
+            system.charges[i] = 0.0;
+        else
+            system.dipoles[i].setZero();
+    }
+    OrthorhombicBox box(side);
+    const Ewald ewald(10.0, 0.3);
+    const ReactionField rf(8.0, 80.0, 1.0, true);
+    InteractionMatrix<OrthorhombicBox> matrix(2, box);
+    matrix.set(0, 0, ewald);
+    matrix.set(0, 1, ewald);
+    matrix.set(1, 1, rf);
+    auto pairs = PairDriver<Ewald, OrthorhombicBox>(ewald, box).compact(system.positions, all_pairs(N));
+
+    double u_matrix = 0, u_virtual = 0;
+    matrix.compute(system.positions, system.charges, system.dipoles, types, pairs); // warm up the scratch buckets
+    double time_matrix = seconds(
+        [&] { u_matrix = matrix.compute(system.positions, system.charges, system.dipoles, types, pairs).energy; });
+    const SchemePair<Ewald> ewald_pair(ewald);
+    const SchemePair<ReactionField> rf_pair(rf);
+    std::vector<vec3> forces(N, vec3::Zero()), torques(N, vec3::Zero());
+    double time_virtual = seconds([&] {
+        for (auto &p : pairs) {
+            const int i = p[0], j = p[1];
+            const VirtualPair &kernel = (types[i] == 1 && types[j] == 1) ? static_cast<const VirtualPair &>(rf_pair)
+                                                                         : ewald_pair;
+            const vec3 r = box.minimum_image(system.positions[j] - system.positions[i]);
+            if (r.squaredNorm() >= kernel.cutoff() * kernel.cutoff())
+                continue;
+            const auto pair = kernel.interaction(r);
+            const double zi = system.charges[i], zj = system.charges[j];
+            const vec3 &mui = system.dipoles[i], &muj = system.dipoles[j];
+            u_virtual += pair.ion_ion_energy(zi, zj) + pair.ion_dipole_energy(zi, muj) +
+                         pair.ion_dipole_energy(zj, mui, -1.0) + pair.dipole_dipole_energy(mui, muj);
+            const vec3 force = pair.ion_ion_force(zi, zj) + pair.ion_dipole_force(zj, mui) -
+                               pair.ion_dipole_force(zi, muj) - pair.dipole_dipole_force(mui, muj);
+            forces[j] += force;
+            forces[i] -= force;
+            torques[i] += mui.cross(pair.dipole_field(muj) - pair.ion_field(zj));
+            torques[j] += muj.cross(pair.dipole_field(mui) + pair.ion_field(zi));
+        }
+    });
+    const double n = pairs.size();
+    std::cout << std::setw(12) << 1e9 * time_matrix / n << std::setw(12) << 1e9 * time_virtual / n << std::setw(12)
+              << time_virtual / time_matrix << std::setw(12) << std::fabs(u_matrix - u_virtual) / std::fabs(u_virtual)
+              << std::endl;
+}
+
+/*
+ * Dipole-dipole energy and force from tabulated radial factors compared to evaluating them per pair
+ */
+template <class Tscheme> void radial_table(const std::string &name, const Tscheme &pot) {
+    const size_t n = 1000000;
+    RadialTable<Tscheme> table(pot, 0.1 * pot.cutoff);
+    std::mt19937 engine(n);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    std::vector<vec3> r(1000), mu(1001);
+    for (auto &v : mu)
+        v = vec3(uniform(engine), uniform(engine), uniform(engine));
+    for (auto &v : r) // uniform in the sphere between 0.2 and 1 cutoff
+        do
+            v = pot.cutoff * vec3(uniform(engine), uniform(engine), uniform(engine));
+        while (v.norm() >= pot.cutoff || v.norm() < 0.2 * pot.cutoff);
+    double u_table = 0, u_exact = 0;
+    vec3 f_table = vec3::Zero(), f_exact = vec3::Zero();
+    double time_table = seconds([&] {
+        for (size_t i = 0; i < n; i++) {
+            auto pair = table.interaction(r[i % r.size()]);
+            u_table += pair.dipole_dipole_energy(mu[i % mu.size()], mu[(i + 1) % mu.size()]);
+            f_table += pair.dipole_dipole_force(mu[i % mu.size()], mu[(i + 1) % mu.size()]);
+        }
+    });
+    double time_exact = seconds([&] {
+        for (size_t i = 0; i < n; i++) {
+            auto pair = pot.template interaction<3>(r[i % r.size()]);
+            u_exact += pair.dipole_dipole_energy(mu[i % mu.size()], mu[(i + 1) % mu.size()]);
+            f_exact += pair.dipole_dipole_force(mu[i % mu.size()], mu[(i + 1) % mu.size()]);
+        }
+    });
+    std::cout << std::setw(12) << name << std::setw(12) << 1e9 * time_table / n << std::setw(12)
+              << 1e9 * time_exact / n << std::setw(12) << time_exact / time_table << std::setw(12)
+              << std::fabs(u_table - u_exact) / std::fabs(u_exact) << std::endl;
+}
+
+/*
+ * Time per step of the inner part of a multiple time-step split compared to the full real-space sum
+ */
+void multiple_time_step(double inner_cutoff, int k) {
+    const size_t N = 4000;
+    const double density = 0.1, side = std::cbrt(N / density);
+    System system(N, density);
+    OrthorhombicBox box(side);
+    const Ewald ewald(10.0, 0.3);
+    MultipleTimeStep<Ewald, OrthorhombicBox> mts(ewald, inner_cutoff, 1.0, box);
+    PairDriver<Ewald, OrthorhombicBox> full(ewald, box);
+    auto pairs = full.compact(system.positions, all_pairs(N));
+    auto inner_pairs = mts.inner().compact(system.positions, pairs);
+    const auto &x = system.positions, &mu = system.dipoles;
+    const auto &z = system.charges;
+    double u_split = 0, u_full = 0;
+    double time_inner = seconds([&] { u_split += mts.inner_forces(x, z, mu, inner_pairs).energy; });
+    double time_outer = seconds([&] { u_split += mts.outer_forces(x, z, mu, pairs).energy; });
+    double time_full = seconds([&] { u_full = full.compute(x, z, mu, pairs).energy; });
+    const double per_step = time_inner + time_outer / k;
+    std::cout << std::setw(12) << inner_cutoff << std::setw(8) << k << std::setw(12) << 1e3 * time_inner
+              << std::setw(12) << 1e3 * time_outer << std::setw(12) << 1e3 * time_full << std::setw(12)
+              << time_full / per_step << std::setw(12) << std::fabs(u_split - u_full) / std::fabs(u_full) << std::endl;
+}
+
+/*
+ * Screened reciprocal-space energy on a mesh compared to the direct k-sum at the same accuracy
+ */
+void particle_mesh(size_t N, double debye_length) {
+    const double density = 0.01, side = std::cbrt(N / density), alpha = 0.3;
+    const int nmax = int(std::ceil(1.1 * alpha * side));
+    System system(N, density);
+    const vec3 L = vec3::Constant(side);
+    int grid = 8;
+    while (side / grid > 0.3 / alpha) // spacing of about 0.3 damping lengths
+        grid *= 2;
+    Ewald ewald(10.0, alpha, infinity, debye_length);
+    ParticleMeshEwald pme(alpha, L, Eigen::Vector3i::Constant(grid), 6, debye_length);
+    double direct = 0, mesh = 0, u_direct = 0;
+    direct = seconds([&] { u_direct = ewald.reciprocal_energy(system.positions, system.charges, system.dipoles, L, nmax); });
+    mesh = seconds([&] { pme.update(system.positions, system.charges, system.dipoles); });
+    std::cout << std::setw(8) << N << std::setw(8) << grid << std::setw(12) << direct << std::setw(12) << mesh
+              << std::setw(12) << direct / mesh << std::setw(12) << std::fabs(pme.energy() / u_direct - 1.0)
+              << std::endl;
+}
+
+int main() {
+    std::cout << std::setprecision(3);
+    treecode("Plain", Plain(), 0.5);
+    treecode("Plain", Plain(), 0.3);
+    treecode("qPotential", qPotential(25.0, 3), 0.5);
+    fast_multipole("Plain", Plain(), 5);
+    fast_multipole("Yukawa", Plain(15.0), 5);
+
+    const double cutoff = 10.0, alpha = 0.3, debye_length = 15.0;
+    std::cout << "\n# special functions: s(q) and three derivatives, ns per evaluation\n"
+              << std::setw(12) << "scheme" << std::setw(12) << "combined" << std::setw(12) << "separate" << std::setw(12)
+              << "speedup" << std::setw(12) << "rel. diff" << "\n";
+    special_functions("Ewald", Ewald(cutoff, alpha, infinity, debye_length));
+    special_functions("EwaldT", EwaldT(cutoff, alpha));
+    special_functions("Wolf", Wolf(cutoff, alpha));
+    special_functions("Fennell", Fennell(cutoff, alpha));
+    special_functions("ZeroDipole", ZeroDipole(cutoff, alpha));
+    special_functions("Zahn", Zahn(cutoff, alpha));
+
+    std::cout << "\n# short_range_functions(): s(q) and three derivatives, ns per distance\n" << std::setw(12)
+              << "scheme" << std::setw(12) << "batch" << std::setw(12) << "scalar" << std::setw(12) << "speedup"
+              << std::setw(12) << "max. diff" << "\n";
+    batch_functions("Ewald", Ewald(cutoff, alpha));
+    batch_functions("Wolf", Wolf(cutoff, alpha));
+    batch_functions("ReactionFld", ReactionField(cutoff, 80.0, 1.0, true));
+    batch_functions("qPotential", qPotential(cutoff, 3));
+    batch_functions("Poisson", Poisson(cutoff, 3, 3));
+    batch_functions("Fanourgakis", Fanourgakis(cutoff));
+
+    std::cout << "\n# Verlet list with 2 A skin, ns per listed pair\n" << std::setw(12) << "scheme" << std::setw(8)
+              << "dipoles" << std::setw(12) << "beyond rc" << std::setw(12) << "branch"
+              << std::setw(12) << "compact" << std::setw(12) << "compacted" << "\n";
+    for (bool dipoles : {false, true}) {
+        verlet_list("Ewald", Ewald(cutoff, alpha), 2.0, dipoles);
+        verlet_list("Poisson", Poisson(cutoff, 1, -1), 2.0, dipoles);
+    }
+
+    std::cout << "\n# cluster pairs at 0.1 particles/A^3, ns per pair inside cutoff\n" << std::setw(12) << "scheme"
+              << std::setw(8) << "dipoles" << std::setw(12) << "pair list" << std::setw(12) << "4x4" << std::setw(12)
+              << "4x4 fill" << std::setw(12) << "8x8" << std::setw(12) << "8x8 fill" << std::setw(12) << "build"
+              << "\n";
+    for (bool dipoles : {false, true}) {
+        cluster_pairs("Ewald", Ewald(cutoff, alpha), dipoles);
+        cluster_pairs("Poisson", Poisson(cutoff, 1, -1), dipoles);
+    }
+
+    std::cout << "\n# ions with Ewald, dipoles with reaction-field, ns per pair within 10 A\n" << std::setw(12)
+              << "matrix" << std::setw(12) << "virtual" << std::setw(12) << "speedup" << std::setw(12) << "rel. diff"
+              << "\n";
+    interaction_matrix();
+
+    std::cout << "\n# dipole-dipole energy and force, ns per pair\n" << std::setw(12) << "scheme" << std::setw(12)
+              << "table" << std::setw(12) << "exact" << std::setw(12) << "speedup" << std::setw(12) << "rel. diff"
+              << "\n";
+    radial_table("Ewald", Ewald(cutoff, alpha, infinity, debye_length));
+    radial_table("Wolf", Wolf(cutoff, alpha));
+    radial_table("qPotential", qPotential(cutoff, 3));
+
+    std::cout << "\n# multiple time-step split of Ewald with dipoles at 0.1 particles/A^3, ms\n" << std::setw(12)
+              << "inner rc" << std::setw(8) << "k" << std::setw(12) << "inner" << std::setw(12) << "outer"
+              << std::setw(12) << "full" << std::setw(12) << "speedup" << std::setw(12) << "rel. diff" << "\n";
+    for (double inner_cutoff : {5.0, 6.0})
+        multiple_time_step(inner_cutoff, 4);
+
+    std::cout << "\n# screened reciprocal energy with dipoles, seconds\n" << std::setw(8) << "N" << std::setw(8) << "grid"
+              << std::setw(12) << "k-sum" << std::setw(12) << "mesh" << std::setw(12) << "speedup" << std::setw(12)
+              << "rel. diff" << "\n";
+    for (size_t N : {500, 2000, 8000})
+        particle_mesh(N, debye_length);
+}
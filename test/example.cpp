@@ -7,8 +7,7 @@ using namespace CoulombGalore;
 typedef Eigen::Vector3d Point; //!< typedef for 3d vector
 
 int main() {
-    double pi = 3.141592653589793, // Pi
-        e0 = 8.85419e-12,          // Permittivity of vacuum [C^2/(J*m)]
+    double e0 = 8.85419e-12,       // Permittivity of vacuum [C^2/(J*m)]
         e = 1.602177e-19,          // Absolute electronic unit charge [C]
         T = 298.15,                // Temperature [K]
         kB = 1.380658e-23;         // Boltzmann's constant [J/K]
@@ -43,10 +42,19 @@ int main() {
     Fanourgakis pot_kis(cutoff);
     Ewald pot_ewald(cutoff, 0.1e10, infinity);
 
-    for (double q = 0; q <= 1; q += 0.01)
-        std::cout << q << " " << pot_qpot3.short_range_function(q) << " " << pot_qpot4.short_range_function(q) << " "
-                  << " " << pot_kis.short_range_function(q) << " "
-                  << " " << pot_ewald.short_range_function(q) << "\n";
+    // short-range functions are evaluated for all distances at once
+    std::vector<double> q(101);
+    for (size_t i = 0; i < q.size(); i++)
+        q[i] = 0.01 * i;
+    std::vector<double> s_qpot3(q.size()), s_qpot4(q.size()), s_kis(q.size()), s_ewald(q.size());
+    pot_qpot3.short_range_functions(q.data(), q.size(), s_qpot3.data());
+    pot_qpot4.short_range_functions(q.data(), q.size(), s_qpot4.data());
+    pot_kis.short_range_functions(q.data(), q.size(), s_kis.data());
+    pot_ewald.short_range_functions(q.data(), q.size(), s_ewald.data());
+    for (size_t i = 0; i < q.size(); i++)
+        std::cout << q[i] << " " << s_qpot3[i] << " " << s_qpot4[i] << " "
+                  << " " << s_kis[i] << " "
+                  << " " << s_ewald[i] << "\n";
 
 #ifdef NLOHMANN_JSON_HPP
     // this is a truncated potential initiated using JSON
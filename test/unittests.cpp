@@ -5,6 +5,7 @@
 
 #include <doctest/doctest.h>
 #include <nlohmann/json.hpp>
+#include <random>
 #include "coulombgalore.h"
 
 using namespace CoulombGalore;
@@ -39,6 +40,7 @@ TEST_CASE("Binomial") {
     CHECK(binomial(3, 1) == 3);
     CHECK(binomial(4, 2) == 6);
     CHECK(binomial(5, 3) == 10);
+    CHECK(binomial(23, 12) == 1352078); // beyond the range of 32 bit factorials
 }
 // numerical differentioation used for unittests, only
 inline double diff1(std::function<double(double)> f, double x, double dx = 1e-4) {
@@ -118,6 +120,16 @@ TEST_CASE("[CoulombGalore] Andrea") {
     CHECK(spline.evalDer(d, x) == Approx(f_prime_exact(x)));
     x = 5;
     CHECK(spline.evalDer(d, x) == Approx(f_prime_exact(x)));
+
+    // A function of many arguments gives the same table
+    auto d_batch = spline.generate(
+        [&](const double *x, size_t n, double *y) {
+            for (size_t i = 0; i < n; i++)
+                y[i] = f(x[i]);
+        },
+        0, 10);
+    CHECK(d_batch.r2 == d.r2);
+    CHECK(d_batch.c == d.c);
 }
 
 TEST_CASE("[CoulombGalore] plain") {
@@ -501,6 +513,36 @@ TEST_CASE("[CoulombGalore] Ewald (Gaussian) real-space") {
     CHECK(potY.short_range_function_derivative(0.5) == Approx(-0.63444119));
     CHECK(potY.short_range_function_second_derivative(0.5) == Approx(4.423133599));
     CHECK(potY.short_range_function_third_derivative(0.5) == Approx(-19.85937171));
+
+    // regression: the Debye-length is passed on to the base class such that the kernels screen
+    const double kappa = 1.0 / debye_length, r = 10.0;
+    CHECK(potY.debye_length == Approx(debye_length));
+    CHECK(potY.ion_potential(1.0, r) == Approx(0.5 *
+                                               (std::erfc(alpha * r + kappa / (2.0 * alpha)) * std::exp(kappa * r) +
+                                                std::erfc(alpha * r - kappa / (2.0 * alpha)) * std::exp(-kappa * r)) /
+                                               r));
+
+    // regression: kappa^2 enters the reciprocal-space exponent once, exp(-(k^2+kappa^2)/(4 alpha^2))/(k^2+kappa^2)
+    const vec3 L(30.0, 30.0, 30.0);
+    const std::vector<vec3> positions = {{1.0, 2.0, 3.0}, {10.0, -4.0, 7.0}}, dipoles(2, vec3::Zero());
+    const std::vector<double> charges = {1.0, -1.0};
+    const int nmax = 3;
+    double energy = 0.0;
+    for (int nx = -nmax; nx <= nmax; nx++)
+        for (int ny = -nmax; ny <= nmax; ny++)
+            for (int nz = -nmax; nz <= nmax; nz++) {
+                const int n2 = nx * nx + ny * ny + nz * nz;
+                if (n2 == 0 || n2 > nmax * nmax)
+                    continue;
+                const vec3 k = 2.0 * pi * vec3(nx, ny, nz).cwiseQuotient(L);
+                const double k2 = k.squaredNorm() + kappa * kappa;
+                std::complex<double> S = 0.0;
+                for (size_t i = 0; i < 2; i++)
+                    S += charges[i] * std::polar(1.0, k.dot(positions[i]));
+                energy += std::norm(S) * std::exp(-k2 / (4.0 * alpha * alpha)) / k2;
+            }
+    energy *= 2.0 * pi / L.prod();
+    CHECK(potY.reciprocal_energy(positions, charges, dipoles, L, nmax) == Approx(energy));
 }
 
 TEST_CASE("[CoulombGalore] Ewald (truncated Gaussian) real-space") {
@@ -562,6 +604,15 @@ TEST_CASE("[CoulombGalore] Poisson") {
 
     testDerivatives(pot33, 0.5); // Compare differentiation with numerical diff.
 
+    // large C and D, where binomial coefficients exceed 32 bit factorials
+    Poisson pot1211(cutoff, 12, 11);
+    CHECK(pot1211.short_range_function_second_derivative(0.5) == Approx(1352078.0 * 11.0 / std::pow(2.0, 21)));
+    for (auto CD : {std::make_pair(12, 11), std::make_pair(10, 3), std::make_pair(3, 10)}) {
+        Poisson pot(cutoff, CD.first, CD.second);
+        testDerivatives(pot, 0.3);
+        testDerivatives(pot, 0.6);
+    }
+
     C = 4;                  // number of cancelled derivatives at origin -2 (starting from second derivative)
     D = 3;                  // number of cancelled derivatives at the cut-off (starting from zeroth derivative)
     double zA = 2.0;        // charge
@@ -895,4 +946,1487 @@ TEST_CASE("[CoulombGalore] Splined") {
         CHECK(pot.short_range_function_second_derivative(0.5) == Approx(4.423133599).epsilon(tol));
         CHECK(pot.short_range_function_third_derivative(0.5) == Approx(-19.85937171).epsilon(tol));
     }
+
+    SUBCASE("Shared tables") {
+        CHECK(pot.tables() == nullptr);
+        CHECK(pot.numKnots().empty());
+        pot.spline<qPotential>(cutoff, 3);
+        Splined copy = pot;
+        CHECK(copy.tables() == pot.tables());
+        CHECK(pot.tables().use_count() == 3);
+
+        // a replica has its own tables with the same content, shared by its copies
+        Splined replica = pot;
+        replica.localize();
+        CHECK(replica.tables() != pot.tables());
+        CHECK(replica.numKnots() == pot.numKnots());
+        CHECK(Splined(replica).tables() == replica.tables());
+        CHECK(replica.short_range_function(0.3) == pot.short_range_function(0.3));
+
+        // re-splining a copy leaves the others untouched
+        copy.spline<Plain>();
+        CHECK(copy.tables() != pot.tables());
+        CHECK(pot.short_range_function(0.3) == Approx(qPotential(cutoff, 3).short_range_function(0.3)).epsilon(tol));
+
+        // concurrent reads from copies in several threads
+        std::vector<double> sums(4, 0.0);
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < sums.size(); t++)
+            threads.emplace_back([&sums, t, pot]() {
+                for (int i = 1; i < 1000; i++)
+                    sums[t] += pot.short_range_function(i / 1000.0);
+            });
+        for (auto &thread : threads)
+            thread.join();
+        CHECK(sums[0] == sums[3]);
+    }
+}
+
+TEST_CASE("[CoulombGalore] PairCache") {
+    using doctest::Approx;
+    double cutoff = 29.0;
+    Poisson pot(cutoff, 3, 3, 23.0);
+    vec3 muA = {19, 7, 11}, muB = {13, 17, 5};
+    mat33 quad;
+    quad << 3, 7, 8, 5, 9, 6, 2, 1, 4;
+    std::vector<vec3> distances = {{23, 0, 0}, {5, -3, 9}, {1, 2, 0.5}, {40, 0, 0}};
+
+    PairCache cache;
+    cache.update(pot, distances);
+    CHECK(cache.size() == distances.size());
+
+    for (size_t i = 0; i < cache.size(); i++) {
+        vec3 r = cache.distance(i);
+        auto f = cache[i];
+        CHECK(r == distances[i]);
+        CHECK(pot.ion_potential(2.0, f) == Approx(pot.ion_potential(2.0, r.norm())));
+        CHECK(pot.ion_dipole_energy(2.0, muB, r, f) == Approx(pot.ion_dipole_energy(2.0, muB, r)));
+        CHECK(pot.dipole_dipole_energy(muA, muB, r, f) == Approx(pot.dipole_dipole_energy(muA, muB, r)));
+        CHECK(pot.ion_quadrupole_energy(2.0, quad, r, f) == Approx(pot.ion_quadrupole_energy(2.0, quad, r)));
+        CHECK(pot.multipole_multipole_energy(2.0, 3.0, muA, muB, quad, quad, r, f) ==
+              Approx(pot.multipole_multipole_energy(2.0, 3.0, muA, muB, quad, quad, r)));
+        CHECK((pot.dipole_dipole_force(muA, muB, r, f) - pot.dipole_dipole_force(muA, muB, r)).norm() ==
+              Approx(0.0));
+        CHECK((pot.multipole_multipole_force(2.0, 3.0, muA, muB, quad, quad, r, f) -
+               pot.multipole_multipole_force(2.0, 3.0, muA, muB, quad, quad, r))
+                  .norm() == Approx(0.0));
+    }
+    // beyond the cutoff
+    CHECK(cache[3].s[0] == 0.0);
+    CHECK(pot.ion_ion_energy(2.0, 3.0, cache[3]) == 0.0);
+}
+
+TEST_CASE("[CoulombGalore] Symmetric quadrupoles") {
+    using doctest::Approx;
+    auto close = [](const vec3 &a, const vec3 &b) { return (a - b).norm() <= 1e-12 * std::max(1.0, b.norm()); };
+    static_assert(sizeof(SymmetricQuadrupole) == 6 * sizeof(double), "six components");
+    static_assert(sizeof(TracelessQuadrupole) == 5 * sizeof(double), "five components");
+    mat33 quad, traceless;
+    quad << 3, 7, 8, 7, 9, 6, 8, 6, 4;
+    traceless = quad - quad.trace() / 3.0 * mat33::Identity();
+    const SymmetricQuadrupole sym(quad);
+    const TracelessQuadrupole tl(quad);
+    const vec3 r(1.1, -2.0, 0.7), muA(0.3, 0.2, -0.5), muB(-0.1, 0.4, 0.2);
+
+    CHECK(sym.matrix() == quad);
+    CHECK((tl.matrix() - traceless).norm() == Approx(0.0));
+    CHECK(SymmetricQuadrupole(tl).trace() == Approx(0.0));
+    CHECK(quadrupole_contraction(sym, r) == Approx(r.dot(quad * r)));
+    CHECK(quadrupole_contraction(tl, r) == Approx(r.dot(traceless * r)));
+    CHECK(close(quadrupole_product(tl, r), traceless * r));
+    CHECK(Ewald::quadrupole_squared(sym) == Approx(Ewald::quadrupole_squared(quad)));
+
+    // a non-symmetric matrix acts through its symmetric part
+    mat33 skewed = quad;
+    skewed(0, 1) += 1.0;
+    skewed(1, 0) -= 1.0;
+    Ewald pot(12.0, 0.2, infinity, 23.0);
+    auto f = pot.pair_factors<3>(r.squaredNorm());
+    CHECK(pot.quadrupole_potential(skewed, r) == Approx(pot.quadrupole_potential(sym, r, f)));
+    CHECK(close(pot.quadrupole_field(sym, r, f), pot.quadrupole_field(quad, r)));
+    CHECK(close(pot.quadrupole_field(tl, r, f), pot.quadrupole_field(traceless, r)));
+    CHECK(close(pot.multipole_field(2.0, muA, sym, r, f), pot.multipole_field(2.0, muA, quad, r)));
+    CHECK(pot.ion_quadrupole_energy(2.0, tl, r, f) == Approx(pot.ion_quadrupole_energy(2.0, traceless, r)));
+    CHECK(pot.multipole_multipole_energy(2.0, -1.0, muA, muB, sym, sym, r, f) ==
+          Approx(pot.multipole_multipole_energy(2.0, -1.0, muA, muB, quad, quad, r)));
+    CHECK(close(pot.ion_quadrupole_force(2.0, sym, r, f), pot.ion_quadrupole_force(2.0, quad, r)));
+    CHECK(close(pot.multipole_multipole_force(2.0, -1.0, muA, muB, tl, tl, r, f),
+                pot.multipole_multipole_force(2.0, -1.0, muA, muB, traceless, traceless, r)));
+
+    // Eigen expressions bind to the matrix overloads
+    const mat33 twice = 2.0 * quad;
+    CHECK(pot.quadrupole_potential(2.0 * quad, r, f) == Approx(pot.quadrupole_potential(twice, r, f)));
+    CHECK(close(pot.quadrupole_field(2.0 * quad, r, f), pot.quadrupole_field(twice, r, f)));
+    CHECK(close(pot.quadrupole_field(quad.transpose(), r, f), pot.quadrupole_field(quad, r, f)));
+    CHECK(pot.ion_quadrupole_energy(2.0, quad + skewed, r, f) == Approx(pot.ion_quadrupole_energy(2.0, twice, r, f)));
+    CHECK(pot.interaction<2>(r).quadrupole_potential(2.0 * quad) == Approx(pot.quadrupole_potential(twice, r)));
+    CHECK(quadrupole_trace(2.0 * quad) == Approx(twice.trace()));
+}
+
+TEST_CASE("[CoulombGalore] PairInteraction") {
+    auto close = [](const vec3 &a, const vec3 &b) { return (a - b).norm() <= 1e-12 * std::max(1.0, b.norm()); };
+    const double zA = 2.0, zB = -3.0;
+    const vec3 muA = {1.9, 0.7, 1.1}, muB = {1.3, -1.7, 0.5};
+    auto check = [&](const auto &pot) {
+        for (vec3 r : {vec3(2.3, 0, 0), vec3(5, -3, 9), vec3(1, 2, 0.5)}) {
+            auto pair = pot.template interaction<3>(r);
+            CHECK(pair.ion_potential(zA) == doctest::Approx(pot.ion_potential(zA, r.norm())));
+            CHECK(pair.dipole_potential(muA) == doctest::Approx(pot.dipole_potential(muA, r)));
+            CHECK(close(pair.ion_field(zA), pot.ion_field(zA, r)));
+            CHECK(close(pair.dipole_field(muA), pot.dipole_field(muA, r)));
+            CHECK(pair.ion_ion_energy(zA, zB) == doctest::Approx(pot.ion_ion_energy(zA, zB, r.norm())));
+            CHECK(pair.ion_dipole_energy(zA, muB) == doctest::Approx(pot.ion_dipole_energy(zA, muB, r)));
+            CHECK(pair.ion_dipole_energy(zB, muA, -1.0) == doctest::Approx(pot.ion_dipole_energy(zB, muA, -r)));
+            CHECK(pair.dipole_dipole_energy(muA, muB) == doctest::Approx(pot.dipole_dipole_energy(muA, muB, r)));
+            CHECK(close(pair.ion_ion_force(zA, zB), pot.ion_ion_force(zA, zB, r)));
+            CHECK(close(pair.ion_dipole_force(zA, muB), pot.ion_dipole_force(zA, muB, r)));
+            CHECK(close(pair.dipole_dipole_force(muA, muB), pot.dipole_dipole_force(muA, muB, r)));
+
+            // lower orders give the same factors they cover
+            CHECK(pot.template interaction<1>(r).field == pair.field);
+            CHECK(pot.template interaction<2>(r).dipole_isotropic == pair.dipole_isotropic);
+        }
+        // beyond the cutoff
+        auto outside = pot.template interaction<3>(vec3(pot.cutoff + 1.0, 0, 0));
+        CHECK(outside.ion_ion_energy(zA, zB) == 0.0);
+        CHECK(outside.dipole_dipole_force(muA, muB) == vec3::Zero());
+    };
+    check(Ewald(12.0, 0.2, infinity, 23.0));
+    check(Poisson(12.0, 3, 3));
+    check(Fanourgakis(12.0));
+}
+
+TEST_CASE("[CoulombGalore] FastMultipole") {
+    using doctest::Approx;
+    const size_t N = 600;
+    std::vector<vec3> positions(N), dipoles(N);
+    std::vector<double> charges(N);
+    srand(1);
+    auto random = []() { return double(rand()) / RAND_MAX; };
+    for (size_t i = 0; i < N; i++) {
+        positions[i] = 40.0 * vec3(random(), random(), random());
+        dipoles[i] = vec3(random() - 0.5, random() - 0.5, random() - 0.5);
+        charges[i] = (i % 2 == 0) ? 1.0 : -1.0;
+    }
+
+    // relative rms error of fields and error of energy compared to direct summation
+    auto compare = [&](const auto &pot, size_t leaf_size, int expected_depth) {
+        FastMultipole<std::decay_t<decltype(pot)>> fmm(pot, 6, leaf_size, 2);
+        fmm.update(positions, charges, dipoles);
+        CHECK(fmm.depth() == expected_depth);
+        double energy = 0.0, error = 0.0, norm = 0.0, phi_error = 0.0;
+        for (size_t i = 0; i < N; i++) {
+            double phi = 0.0;
+            vec3 E = vec3::Zero();
+            for (size_t j = 0; j < N; j++) {
+                if (i == j)
+                    continue;
+                vec3 r = positions[i] - positions[j];
+                phi += pot.ion_potential(charges[j], r.norm()) + pot.dipole_potential(dipoles[j], r);
+                E += pot.ion_field(charges[j], r) + pot.dipole_field(dipoles[j], r);
+            }
+            energy += 0.5 * (charges[i] * phi - dipoles[i].dot(E));
+            error += (fmm.fields()[i] - E).squaredNorm();
+            norm += E.squaredNorm();
+            phi_error = std::max(phi_error, std::fabs(fmm.potentials()[i] - phi));
+        }
+        CHECK(std::sqrt(error / norm) < 1e-4);
+        CHECK(phi_error < 1e-4);
+        CHECK(fmm.energy() == Approx(energy).epsilon(1e-5));
+        CHECK_THROWS(fmm.forces()); // no field gradient on dipoles
+
+        // cached M2L operators are reused or rebuilt as the tree changes
+        auto fields = fmm.fields();
+        fmm.update(positions, charges, dipoles);
+        CHECK((fmm.fields()[7] - fields[7]).norm() == Approx(0.0));
+        fmm.update(positions, charges);
+        fields = fmm.fields();
+        const double size = fmm.size();
+        CHECK(size >= 40.0 * (1.0 - 1e-3));
+        std::vector<vec3> moved(N), scaled(N);
+        for (size_t i = 0; i < N; i++) {
+            moved[i] = positions[i] + 0.2 * vec3(random() - 0.5, random() - 0.5, random() - 0.5);
+            scaled[i] = 0.5 * positions[i];
+        }
+        fmm.update(moved, charges);
+        CHECK(fmm.size() == size); // same cell sizes and M2L operators
+        fmm.update(scaled, charges);
+        CHECK(fmm.size() == Approx(0.5 * size));
+        CHECK((fmm.forces()[7] - charges[7] * fmm.fields()[7]).norm() == Approx(0.0));
+        if (std::isinf(pot.debye_length)) // Coulomb fields scale as 1/r^2
+            for (size_t i : {0, 7, 123})
+                CHECK((fmm.fields()[i] - 4.0 * fields[i]).norm() < 1e-9 * fields[i].norm());
+    };
+
+    SUBCASE("Coulomb") {
+        compare(Plain(), 64, 1); // 75 particles per leaf rather than 9
+        compare(Plain(), 16, 2);
+        compare(Plain(), 2, 3);
+    }
+    SUBCASE("Yukawa") { compare(Plain(10.0), 2, 3); }
+    SUBCASE("Empty") {
+        FastMultipole<Plain> fmm{Plain()};
+        fmm.update({}, {});
+        CHECK(fmm.energy() == 0.0);
+    }
+    CHECK_THROWS(FastMultipole<Plain>(Plain(), 0));
+}
+
+TEST_CASE("[CoulombGalore] TreeCode") {
+    using doctest::Approx;
+    const size_t N = 500;
+    std::vector<vec3> positions(N), dipoles(N);
+    std::vector<double> charges(N);
+    srand(2);
+    auto random = []() { return double(rand()) / RAND_MAX; };
+    for (size_t i = 0; i < N; i++) {
+        positions[i] = 30.0 * vec3(random(), random(), random());
+        dipoles[i] = vec3(random() - 0.5, random() - 0.5, random() - 0.5);
+        charges[i] = (i % 2 == 0) ? 1.0 : -1.0;
+    }
+
+    // relative rms error of fields and potentials compared to direct summation
+    auto compare = [&](const auto &pot, double theta, double tolerance) {
+        TreeCode<std::decay_t<decltype(pot)>> tree(pot, theta, 4, 2);
+        tree.update(positions, charges, dipoles);
+        auto E = tree.fields();
+        auto phi = tree.potentials();
+        double error = 0.0, norm = 0.0, phi_error = 0.0, phi_norm = 0.0;
+        for (size_t i = 0; i < N; i++) {
+            double phi_exact = 0.0;
+            vec3 E_exact = vec3::Zero();
+            for (size_t j = 0; j < N; j++) {
+                if (i == j)
+                    continue;
+                vec3 r = positions[i] - positions[j];
+                phi_exact += pot.ion_potential(charges[j], r.norm()) + pot.dipole_potential(dipoles[j], r);
+                E_exact += pot.ion_field(charges[j], r) + pot.dipole_field(dipoles[j], r);
+            }
+            error += (E[i] - E_exact).squaredNorm();
+            norm += E_exact.squaredNorm();
+            phi_error += std::pow(phi[i] - phi_exact, 2);
+            phi_norm += phi_exact * phi_exact;
+        }
+        CHECK(std::sqrt(error / norm) < tolerance);
+        CHECK(std::sqrt(phi_error / phi_norm) < tolerance);
+    };
+
+    SUBCASE("Exact") { compare(Plain(), 0.0, 1e-12); }
+    SUBCASE("Coulomb") { compare(Plain(), 0.3, 1e-2); }
+    SUBCASE("Yukawa") { compare(Plain(8.0), 0.3, 1e-2); }
+    SUBCASE("Truncated") {
+        compare(qPotential(12.0, 3), 0.3, 1e-2);
+        compare(Poisson(12.0, 3, 3, 10.0), 0.3, 1e-2);
+    }
+    CHECK_THROWS(TreeCode<Plain>(Plain(), 1.0));
+}
+
+TEST_CASE("[CoulombGalore] erfc_exp") {
+    using doctest::Approx;
+    for (double x : {-3.0, -0.5, 0.0, 1e-3, 0.7, 2.5, 5.999, 6.0, 9.0, 26.0}) {
+        double erfc, gauss;
+        erfc_exp(x, erfc, gauss);
+        CHECK(gauss == Approx(std::exp(-x * x)).epsilon(1e-14));
+        CHECK(erfc == Approx(std::erfc(x)).epsilon(1e-13));
+        if (x < 6.0)
+            CHECK(erfcx(x) == Approx(std::exp(x * x) * std::erfc(x)).epsilon(1e-13));
+    }
+    CHECK(erfcx(30.0) == Approx(0.01879594).epsilon(1e-6)); // asymptotic expansion
+
+    std::vector<double> x = {-1.0, 0.1, 3.0, 7.0}, erfc(4), gauss(4);
+    erfc_exp(x.data(), erfc.data(), gauss.data(), x.size());
+    for (size_t i = 0; i < x.size(); i++)
+        CHECK(erfc[i] == Approx(std::erfc(x[i])).epsilon(1e-13));
+
+    // combined short-range function and derivatives must match the individual functions
+    auto check_combined = [](const auto &pot) {
+        for (double q : {0.0, 0.2, 0.5, 0.9, 1.0}) {
+            std::array<double, 4> s;
+            pot.template short_range_function_and_derivatives<3>(q, s);
+            CHECK(s[0] == Approx(pot.short_range_function(q)));
+            CHECK(s[1] == Approx(pot.short_range_function_derivative(q)));
+            CHECK(s[2] == Approx(pot.short_range_function_second_derivative(q)));
+            CHECK(s[3] == Approx(pot.short_range_function_third_derivative(q)));
+        }
+    };
+    check_combined(Ewald(29.0, 0.1, infinity));
+    check_combined(Ewald(29.0, 0.1, infinity, 23.0));
+    check_combined(EwaldT(29.0, 0.1));
+    check_combined(Wolf(29.0, 0.1));
+    check_combined(Fennell(29.0, 0.1));
+    check_combined(ZeroDipole(29.0, 0.1));
+    check_combined(Zahn(29.0, 0.1));
+}
+
+#ifdef COULOMBGALORE_INSTRUMENT
+TEST_CASE("[CoulombGalore] Instrumentation") {
+    using namespace Instrument;
+    reset();
+    Poisson pot(10.0, 1, 1);
+    vec3 mu = {1, 0, 0};
+    pot.ion_potential(1.0, 5.0);
+    pot.ion_potential(1.0, 11.0);
+    pot.dipole_dipole_energy(mu, mu, {3, 0, 0});
+    pot.dipole_dipole_energy(mu, mu, {30, 0, 0});
+    auto c = total(Scheme::poisson);
+    CHECK(c.calls == 4);
+    CHECK(c.cutoff_rejections == 2);
+
+    // counts from other threads are included
+    std::thread([&] { pot.ion_potential(1.0, 5.0); }).join();
+    CHECK(total(Scheme::poisson).calls == 5);
+    CHECK(local().get(Scheme::poisson).calls == 4);
+
+    Splined splined;
+    splined.spline<Wolf>(10.0, 0.1);
+    reset();
+    splined.short_range_function(0.5);
+    splined.short_range_function(0.7);
+    c = total(Scheme::spline);
+    CHECK(c.table_lookups == 2);
+    CHECK(c.out_of_range == 0);
+
+    Ewald ewald(10.0, 0.1);
+    std::vector<vec3> positions = {{0, 0, 0}, {1, 0, 0}}, dipoles = {{0, 0, 0}, {0, 0, 0}};
+    ewald.reciprocal_energy(positions, {1.0, -1.0}, dipoles, {20, 20, 20}, 3);
+    CHECK(total(Scheme::ewald).seconds > 0.0);
+
+#ifdef NLOHMANN_JSON_HPP
+    nlohmann::json j;
+    Instrument::to_json(j);
+    CHECK(j.count("ewald") == 1);
+    CHECK(j.count("plain") == 0);
+    pot.to_json(j);
+    CHECK(j.at("instrumentation").at("calls") == total(Scheme::poisson).calls);
+#endif
+    reset();
+    CHECK(total(Scheme::poisson).calls == 0);
+}
+#endif
+
+TEST_CASE("[CoulombGalore] PairDriver") {
+    using doctest::Approx;
+    SUBCASE("Boxes") {
+        OrthorhombicBox box(vec3(10, 20, 30));
+        CHECK(box.volume() == Approx(6000));
+        CHECK(box.inscribed_radius() == Approx(5));
+        vec3 r = box.minimum_image({9, -11, 14});
+        CHECK(r.x() == Approx(-1));
+        CHECK(r.y() == Approx(9));
+        CHECK(r.z() == Approx(14));
+
+        // a triclinic cell with right angles equals the orthorhombic cell
+        auto tbox = TriclinicBox::from_lengths_and_angles({10, 20, 30}, {90, 90, 90});
+        CHECK(tbox.volume() == Approx(6000));
+        CHECK((tbox.minimum_image({9, -11, 14}) - r).norm() == Approx(0.0));
+
+        // skewed cell; minimum image must be the shortest of all images for short vectors
+        auto skewed = TriclinicBox::from_lengths_and_angles({10, 11, 12}, {80, 70, 65});
+        mat33 h = skewed.matrix();
+        CHECK(h.col(0).dot(h.col(1).cross(h.col(2))) == Approx(skewed.volume()));
+        srand(3);
+        for (int n = 0; n < 200; n++) {
+            vec3 r = 30.0 * vec3::Random();
+            vec3 image = skewed.minimum_image(r);
+            double shortest = infinity;
+            for (int i = -5; i <= 5; i++)
+                for (int j = -5; j <= 5; j++)
+                    for (int k = -5; k <= 5; k++)
+                        shortest = std::min(shortest, (r + h * vec3(i, j, k)).norm());
+            if (shortest < skewed.inscribed_radius())
+                CHECK(image.norm() == Approx(shortest));
+            double x = r.x(), y = r.y(), z = r.z();
+            skewed.minimum_image(&x, &y, &z, 1);
+            CHECK((vec3(x, y, z) - image).norm() == Approx(0.0));
+        }
+        CHECK_THROWS(TriclinicBox({1, 1, 0}, {0, 1, 0}, {0, 0, 1}));
+    }
+
+    SUBCASE("Periodic") {
+        const size_t N = 100;
+        const double side = 30.0, cutoff = 12.0;
+        Poisson pot(cutoff, 2, 1);
+        OrthorhombicBox box(side);
+        std::vector<vec3> positions(N), dipoles(N);
+        std::vector<double> charges(N);
+        srand(4);
+        for (size_t i = 0; i < N; i++) {
+            positions[i] = side * (0.5 * vec3::Random());
+            dipoles[i] = 0.5 * vec3::Random();
+            charges[i] = (i % 2 == 0) ? 1.0 : -1.0;
+        }
+        PairDriver<Poisson, OrthorhombicBox> driver(pot, box);
+        auto pairs = all_pairs(N);
+        auto result = driver.compute(positions, charges, dipoles, pairs);
+
+        // reference using the scalar minimum image and virtual interface
+        double energy = 0.0;
+        std::vector<vec3> forces(N, vec3::Zero()), torques(N, vec3::Zero());
+        size_t inside = 0;
+        for (auto &p : pairs) {
+            int i = p[0], j = p[1];
+            vec3 r = box.minimum_image(positions[j] - positions[i]);
+            if (r.norm() < cutoff)
+                inside++;
+            energy += pot.multipole_multipole_energy(charges[i], charges[j], dipoles[i], dipoles[j], mat33::Zero(),
+                                                     mat33::Zero(), r);
+            torques[i] += dipoles[i].cross(pot.ion_field(charges[j], -r) + pot.dipole_field(dipoles[j], -r));
+            torques[j] += dipoles[j].cross(pot.ion_field(charges[i], r) + pot.dipole_field(dipoles[i], r));
+        }
+        CHECK(result.pairs_in_cutoff == inside);
+        CHECK(result.energy == Approx(energy));
+        for (size_t i = 0; i < N; i += 17)
+            CHECK((result.torques[i] - torques[i]).norm() == Approx(0.0).epsilon(1e-10));
+
+        // forces from finite differences of the energy
+        const double h = 1e-5;
+        for (size_t i : {0, 31, 77}) {
+            vec3 gradient;
+            for (int d = 0; d < 3; d++) {
+                auto displaced = positions;
+                displaced[i][d] += h;
+                double up = driver.compute(displaced, charges, dipoles, pairs).energy;
+                displaced[i][d] -= 2 * h;
+                double down = driver.compute(displaced, charges, dipoles, pairs).energy;
+                gradient[d] = (up - down) / (2 * h);
+            }
+            CHECK((result.forces[i] + gradient).norm() == Approx(0.0).epsilon(1e-5));
+        }
+
+        // ions only
+        auto ions = driver.compute(positions, charges, {}, pairs);
+        CHECK(ions.torques.empty());
+        double ion_energy = 0.0;
+        for (auto &p : pairs)
+            ion_energy += pot.ion_ion_energy(charges[p[0]], charges[p[1]],
+                                             box.minimum_image(positions[p[1]] - positions[p[0]]).norm());
+        CHECK(ions.energy == Approx(ion_energy));
+
+        CHECK_THROWS(PairDriver<Poisson, OrthorhombicBox>(pot, OrthorhombicBox(20.0)));
+
+        // compacted list gives the same result
+        auto compacted = driver.compact(positions, pairs);
+        CHECK(compacted.size() == result.pairs_in_cutoff);
+        auto other = driver.compute(positions, charges, dipoles, compacted);
+        CHECK(other.pairs_in_cutoff == result.pairs_in_cutoff);
+        CHECK(other.energy == Approx(result.energy));
+        for (size_t i = 0; i < N; i += 7) {
+            CHECK((other.forces[i] - result.forces[i]).norm() == Approx(0.0).epsilon(1e-10));
+            CHECK((other.torques[i] - result.torques[i]).norm() == Approx(0.0).epsilon(1e-10));
+        }
+    }
+}
+
+TEST_CASE("[CoulombGalore] ClusterPairDriver") {
+    using doctest::Approx;
+    const size_t N = 101; // not a multiple of the cluster size
+    const double side = 25.0;
+    std::vector<vec3> positions(N), dipoles(N);
+    std::vector<double> charges(N);
+    srand(5);
+    for (size_t i = 0; i < N; i++) {
+        positions[i] = side * (0.5 * vec3::Random());
+        dipoles[i] = 0.5 * vec3::Random();
+        charges[i] = (i % 3 == 0) ? 1.0 : -0.5;
+    }
+    auto pairs = all_pairs(N);
+
+    auto compare = [&](const PairAccumulator &a, const PairAccumulator &b) {
+        CHECK(a.pairs_in_cutoff == b.pairs_in_cutoff);
+        CHECK(a.energy == Approx(b.energy));
+        REQUIRE(a.forces.size() == b.forces.size());
+        REQUIRE(a.torques.size() == b.torques.size());
+        double force_error = 0, torque_error = 0;
+        for (size_t i = 0; i < a.forces.size(); i++)
+            force_error = std::max(force_error, (a.forces[i] - b.forces[i]).norm());
+        for (size_t i = 0; i < a.torques.size(); i++)
+            torque_error = std::max(torque_error, (a.torques[i] - b.torques[i]).norm());
+        CHECK(force_error == Approx(0.0).epsilon(1e-10));
+        CHECK(torque_error == Approx(0.0).epsilon(1e-10));
+    };
+
+    SUBCASE("Periodic") {
+        Ewald pot(10.0, 0.3);
+        OrthorhombicBox box(side);
+        auto reference = PairDriver<Ewald, OrthorhombicBox>(pot, box).compute(positions, charges, dipoles, pairs);
+        ClusterPairDriver<Ewald, OrthorhombicBox, 4> driver4(pot, box);
+        driver4.update(positions, charges, dipoles);
+        CHECK(driver4.size() > 0);
+        compare(driver4.compute(), reference);
+        ClusterPairDriver<Ewald, OrthorhombicBox, 8> driver8(pot, box);
+        driver8.update(positions, charges);
+        compare(driver8.compute(), PairDriver<Ewald, OrthorhombicBox>(pot, box).compute(positions, charges, {}, pairs));
+    }
+
+    SUBCASE("Triclinic") {
+        Poisson pot(8.0, 2, 1);
+        auto box = TriclinicBox::from_lengths_and_angles({side, side, side}, {80, 75, 70});
+        auto reference = PairDriver<Poisson, TriclinicBox>(pot, box).compute(positions, charges, dipoles, pairs);
+        ClusterPairDriver<Poisson, TriclinicBox, 4> driver(pot, box);
+        driver.update(positions, charges, dipoles);
+        compare(driver.compute(), reference);
+    }
+
+    SUBCASE("Open") {
+        Poisson pot(8.0, 2, 1);
+        auto reference = PairDriver<Poisson>(pot).compute(positions, charges, dipoles, pairs);
+        ClusterPairDriver<Poisson, OpenBoundary, 8> driver(pot);
+        driver.update(positions, charges, dipoles);
+        CHECK(driver.size() < (N / 8 + 1) * (N / 8 + 2) / 2); // some cluster pairs are skipped
+        compare(driver.compute(), reference);
+    }
+
+    SUBCASE("Cell grid") { // many cells per side, and wrapped as well as unwrapped positions
+        const size_t n = 1500;
+        const double L = 40.0;
+        std::vector<vec3> r(n);
+        std::vector<double> z(n);
+        for (size_t i = 0; i < n; i++) {
+            r[i] = L * (0.5 * vec3::Random()) + ((i % 5 == 0) ? vec3(L, 0, -L) : vec3::Zero());
+            z[i] = (i % 2 == 0) ? 1.0 : -1.0;
+        }
+        Poisson pot(6.0, 2, 1);
+        OrthorhombicBox box(L);
+        ClusterPairDriver<Poisson, OrthorhombicBox, 4> periodic(pot, box);
+        periodic.update(r, z);
+        compare(periodic.compute(), PairDriver<Poisson, OrthorhombicBox>(pot, box).compute(r, z, {}, all_pairs(n)));
+        ClusterPairDriver<Poisson, OpenBoundary, 4> open(pot);
+        open.update(r, z);
+        compare(open.compute(), PairDriver<Poisson>(pot).compute(r, z, {}, all_pairs(n)));
+    }
+}
+
+TEST_CASE("[CoulombGalore] EwaldTuner") {
+    using doctest::Approx;
+    const size_t N = 200;
+    const vec3 L(20, 20, 20);
+    CHECK(EwaldTuner::number_of_wavevectors(1) == 6);
+    CHECK(EwaldTuner::number_of_wavevectors(2) == 32);
+
+    // estimated real-space force error compared to the explicit sum beyond the cutoff
+    std::vector<vec3> positions(N), dipoles(N);
+    std::vector<double> charges(N);
+    srand(6);
+    for (size_t i = 0; i < N; i++) {
+        positions[i] = 0.5 * (vec3::Random() + vec3::Ones()).cwiseProduct(L);
+        dipoles[i] = vec3::Random().normalized();
+        charges[i] = (i % 2 == 0) ? 1.0 : -1.0;
+    }
+    const double cutoff = 6.0, alpha = 0.4, outer = 16.0;
+    Ewald reference(outer, alpha);
+    auto tail_error = [&](bool with_dipoles) {
+        double sum = 0.0;
+        for (size_t i = 0; i < N; i++) {
+            vec3 force = vec3::Zero();
+            for (size_t j = 0; j < N; j++)
+                for (int nx = -1; nx <= 1; nx++)
+                    for (int ny = -1; ny <= 1; ny++)
+                        for (int nz = -1; nz <= 1; nz++) {
+                            vec3 r = positions[i] - positions[j] + L.cwiseProduct(vec3(nx, ny, nz));
+                            double r1 = r.norm();
+                            if (r1 > cutoff && r1 < outer) {
+                                force += reference.ion_ion_force(charges[j], charges[i], r);
+                                if (with_dipoles)
+                                    force += reference.ion_dipole_force(charges[i], dipoles[j], -r) -
+                                             reference.ion_dipole_force(charges[j], dipoles[i], r) -
+                                             reference.dipole_dipole_force(dipoles[i], dipoles[j], -r);
+                            }
+                        }
+            sum += force.squaredNorm();
+        }
+        return std::sqrt(sum / N);
+    };
+    EwaldTuner ions(N, L, N);
+    double estimate = ions.real_space_error(cutoff, alpha);
+    double actual = tail_error(false);
+    CHECK(actual / estimate > 0.5);
+    CHECK(actual / estimate < 2.0);
+    EwaldTuner multipoles(N, L, N, N);
+    estimate = multipoles.real_space_error(cutoff, alpha);
+    actual = tail_error(true);
+    CHECK(actual / estimate > 0.5);
+    CHECK(actual / estimate < 2.0);
+
+    // tuned parameters meet the target and a tighter target costs more
+    for (auto measure : {EwaldTuner::Measure::force, EwaldTuner::Measure::energy}) {
+        auto loose = multipoles.tune(1e-3, measure), tight = multipoles.tune(1e-5, measure);
+        CHECK(loose.cutoff <= 10.0);
+        CHECK(std::hypot(loose.real_space_error, loose.reciprocal_error) <= Approx(1e-3));
+        CHECK(std::hypot(tight.real_space_error, tight.reciprocal_error) <= Approx(1e-5));
+        CHECK(tight.seconds > loose.seconds);
+    }
+    CHECK_THROWS(ions.tune(1e-30, EwaldTuner::Measure::force, 3.0));
+
+    // cheap reciprocal space favours shorter cutoffs
+    EwaldTuner tuner(2000, {50, 50, 50}, 2000), cheap = tuner;
+    cheap.set_costs(1000.0, 1.0);
+    CHECK(cheap.tune(1e-4).cutoff < tuner.tune(1e-4).cutoff);
+    CHECK(cheap.tune(1e-4).nmax > tuner.tune(1e-4).nmax);
+
+#ifdef NLOHMANN_JSON_HPP
+    nlohmann::json j = ions.tune(1e-4);
+    CHECK(j["type"] == "ewald");
+    auto scheme = createScheme(j);
+    CHECK(scheme->cutoff == Approx(j["cutoff"].get<double>()));
+    CHECK(j["nmax"].get<int>() > 0);
+#endif
+}
+
+TEST_CASE("[CoulombGalore] Ewald quadrupoles") {
+    using doctest::Approx;
+    // a linear quadrupole built from three point charges compared to a point quadrupole
+    const vec3 L(10, 10, 10);
+    const double d = 0.02, q = 100.0, cutoff = 4.9, alpha = 0.8;
+    const int nmax = 12;
+    const vec3 center(5.2, 4.1, 6.3), axis = vec3(1, 2, 2).normalized();
+    const mat33 quad = 2.0 * q * d * d * axis * axis.transpose();
+    std::vector<vec3> ions = {{1, 1, 1}, {3, 7, 2}, {8, 2, 5}, {6, 8, 9}};
+    std::vector<double> ion_charges = {1.0, -1.0, 0.5, -0.5};
+
+    auto minimum_image = [&](vec3 r) {
+        for (int k = 0; k < 3; k++)
+            r[k] -= L[k] * std::round(r[k] / L[k]);
+        return r;
+    };
+
+    {
+        Ewald pot(cutoff, alpha);
+
+        // point charges; the intra-molecular Coulomb energy is subtracted
+        std::vector<vec3> positions = ions;
+        std::vector<double> charges = ion_charges;
+        for (double sign : {-1.0, 0.0, 1.0}) {
+            positions.push_back(center + sign * d * axis);
+            charges.push_back(sign == 0.0 ? -2.0 * q : q);
+        }
+        double energy_charges = 0.0, self = 0.0;
+        for (size_t i = 0; i < positions.size(); i++) {
+            self += pot.self_energy({charges[i] * charges[i], 0.0, 0.0});
+            for (size_t j = i + 1; j < positions.size(); j++) {
+                vec3 r = minimum_image(positions[j] - positions[i]);
+                energy_charges += pot.ion_ion_energy(charges[i], charges[j], r.norm());
+                if (i >= ions.size()) // intra-molecular
+                    energy_charges -= charges[i] * charges[j] / r.norm();
+            }
+        }
+        std::vector<vec3> no_dipoles(positions.size(), vec3::Zero());
+        energy_charges += self + pot.reciprocal_energy(positions, charges, no_dipoles, L, nmax);
+
+        // point quadrupole
+        positions = ions;
+        positions.push_back(center);
+        charges = ion_charges;
+        charges.push_back(0.0);
+        std::vector<mat33> quadrupoles(positions.size(), mat33::Zero());
+        quadrupoles.back() = quad;
+        no_dipoles.resize(positions.size());
+        double energy_quadrupole = 0.0;
+        for (size_t i = 0; i < positions.size(); i++) {
+            energy_quadrupole += pot.self_energy(
+                {charges[i] * charges[i], 0.0, pot.quadrupole_squared(quadrupoles[i])});
+            for (size_t j = i + 1; j < positions.size(); j++)
+                energy_quadrupole += pot.multipole_multipole_energy(
+                    charges[i], charges[j], vec3::Zero(), vec3::Zero(), quadrupoles[i], quadrupoles[j],
+                    minimum_image(positions[j] - positions[i]));
+        }
+        energy_quadrupole += pot.reciprocal_energy(positions, charges, no_dipoles, quadrupoles, L, nmax);
+        CHECK(energy_quadrupole == Approx(energy_charges).epsilon(1e-3));
+    }
+
+    // screened self-energy from the reciprocal-space self-term, -1/(30 pi) int k^6 exp(-(k^2+kappa^2)/4alpha^2)/(k^2+kappa^2) dk
+    const double kappa = 1.0 / 7.0, dk = 1e-3;
+    double integral = 0.0;
+    for (double k = 0.5 * dk; k < 40.0; k += dk)
+        integral += std::pow(k, 6) * std::exp(-(k * k + kappa * kappa) / (4.0 * alpha * alpha)) / (k * k + kappa * kappa) * dk;
+    CHECK(Ewald(cutoff, alpha, infinity, 7.0).self_energy({0.0, 0.0, 1.0}) == Approx(-integral / (30.0 * M_PI)));
+
+    // the truncated Gaussian approaches the Gaussian for large damping
+    Ewald ewald(10.0, 0.6);
+    EwaldT ewaldt(10.0, 0.6);
+    CHECK(ewaldt.self_energy({0.0, 0.0, 1.0}) == Approx(ewald.self_energy({0.0, 0.0, 1.0})));
+    CHECK(ewald.self_energy({0.0, 0.0, 1.0}) == Approx(-2.0 * std::pow(0.6, 5) / (5.0 * std::sqrt(M_PI))));
+    CHECK(ewald.quadrupole_squared(quad) == Approx(1.5 * std::pow(2.0 * q * d * d, 2)));
+}
+
+TEST_CASE("[CoulombGalore] ParticleMeshEwald") {
+    using doctest::Approx;
+    const vec3 L(10, 12, 11);
+    const size_t N = 30;
+    std::vector<vec3> positions(N), dipoles(N);
+    std::vector<double> charges(N);
+    srand(7);
+    for (size_t i = 0; i < N; i++) {
+        positions[i] = 0.5 * (vec3::Random() + vec3::Ones()).cwiseProduct(L);
+        dipoles[i] = 0.3 * vec3::Random();
+        charges[i] = (i % 2 == 0) ? 1.0 : -1.0;
+    }
+    std::vector<vec3> no_dipoles(N, vec3::Zero());
+    CHECK_THROWS(ParticleMeshEwald(0.8, L, {30, 32, 32}));
+    CHECK_THROWS(ParticleMeshEwald(0.8, L, {32, 4, 32}, 6)); // fewer grid points than the spline order
+
+    const double cutoff = 4.9, alpha = 0.8;
+    for (double debye_length : {infinity, 7.0}) {
+        Ewald ewald(cutoff, alpha, infinity, debye_length);
+        ParticleMeshEwald pme(alpha, L, {32, 64, 32}, 6, debye_length);
+        pme.update(positions, charges);
+        CHECK(pme.energy() == Approx(ewald.reciprocal_energy(positions, charges, no_dipoles, L, 20)).epsilon(1e-5));
+        pme.update(positions, charges, dipoles);
+        CHECK(pme.energy() == Approx(ewald.reciprocal_energy(positions, charges, dipoles, L, 20)).epsilon(1e-5));
+
+        // the energy is twice the sum over particles of the interaction with the potential and field
+        double u = 0.0;
+        for (size_t i = 0; i < N; i++)
+            u += 0.5 * (charges[i] * pme.potentials()[i] - dipoles[i].dot(pme.fields()[i]));
+        CHECK(pme.energy() == Approx(u));
+        CHECK_THROWS(pme.forces()); // no field gradient on dipoles
+
+        // forces on charges from the energy derivative
+        pme.update(positions, charges);
+        const vec3 force = pme.forces()[3];
+        const double h = 1e-5;
+        for (int d = 0; d < 3; d++) {
+            auto displaced = positions;
+            displaced[3][d] += h;
+            pme.update(displaced, charges);
+            const double up = pme.energy();
+            displaced[3][d] -= 2.0 * h;
+            pme.update(displaced, charges);
+            CHECK(force[d] == Approx(-(up - pme.energy()) / (2.0 * h)).epsilon(1e-6));
+        }
+    }
+
+    // with screening, real-space, reciprocal and self-energies add up independently of alpha
+    const double debye_length = 7.0;
+    auto total_energy = [&](double alpha) {
+        Ewald ewald(cutoff, alpha, infinity, debye_length);
+        double u = ewald.reciprocal_energy(positions, charges, no_dipoles, L, 20);
+        for (size_t i = 0; i < N; i++) {
+            u += ewald.self_energy({charges[i] * charges[i], 0.0});
+            for (size_t j = i + 1; j < N; j++) {
+                vec3 r = positions[j] - positions[i];
+                r -= L.cwiseProduct((r.cwiseQuotient(L)).array().round().matrix());
+                u += ewald.ion_ion_energy(charges[i], charges[j], r.norm());
+            }
+        }
+        return u;
+    };
+    CHECK(total_energy(0.7) == Approx(total_energy(0.9)).epsilon(1e-6));
+}
+
+TEST_CASE("[CoulombGalore] Virial") {
+    using doctest::Approx;
+    const size_t N = 60;
+    const vec3 L(14, 15, 16);
+    std::vector<vec3> positions(N), dipoles(N);
+    std::vector<double> charges(N);
+    srand(8);
+    for (size_t i = 0; i < N; i++) {
+        positions[i] = 0.5 * (vec3::Random() + vec3::Ones()).cwiseProduct(L);
+        dipoles[i] = 0.4 * vec3::Random();
+        charges[i] = (i % 2 == 0) ? 1.0 : -1.0;
+    }
+    auto strained = [&](int d, double h) { // stretch positions and cell along one axis
+        std::vector<vec3> p = positions;
+        for (auto &r : p)
+            r[d] *= 1.0 + h;
+        vec3 box = L;
+        box[d] *= 1.0 + h;
+        return std::make_pair(p, box);
+    };
+    auto torque_axial = [](const mat33 &W) { return vec3(W(1, 2) - W(2, 1), W(2, 0) - W(0, 2), W(0, 1) - W(1, 0)); };
+    const double h = 1e-6;
+
+    // real-space pairs; Poisson with D > 0 is smooth at the cutoff
+    Poisson pot(6.5, 3, 3);
+    for (bool with_dipoles : {false, true}) {
+        std::vector<vec3> mu = with_dipoles ? dipoles : std::vector<vec3>();
+        auto energy = [&](int d, double h) {
+            auto s = strained(d, h);
+            return PairDriver<Poisson, OrthorhombicBox>(pot, OrthorhombicBox(s.second))
+                .compute(s.first, charges, mu, all_pairs(N))
+                .energy;
+        };
+        PairDriver<Poisson, OrthorhombicBox> driver(pot, OrthorhombicBox(L));
+        auto result = driver.compute(positions, charges, mu, all_pairs(N), true);
+        CHECK(driver.compute(positions, charges, mu, all_pairs(N)).virial == mat33::Zero());
+        for (int d = 0; d < 3; d++)
+            CHECK(result.virial(d, d) == Approx(-(energy(d, h) - energy(d, -h)) / (2.0 * h)).epsilon(1e-5));
+        if (with_dipoles) {
+            vec3 torque = vec3::Zero();
+            for (auto &t : result.torques)
+                torque += t;
+            CHECK((torque_axial(result.virial) + torque).norm() == Approx(0.0).epsilon(1e-10));
+        } else
+            CHECK((result.virial - result.virial.transpose()).norm() == Approx(0.0).epsilon(1e-10));
+        CHECK((driver.compute(positions, charges, mu, driver.compact(positions, all_pairs(N)), true).virial -
+               result.virial).norm() == Approx(0.0).epsilon(1e-10));
+
+        ClusterPairDriver<Poisson, OrthorhombicBox> clusters(pot, OrthorhombicBox(L));
+        clusters.update(positions, charges, mu);
+        CHECK((clusters.compute(true).virial - result.virial).norm() == Approx(0.0).epsilon(1e-10));
+    }
+
+    // reciprocal and surface terms of Ewald
+    Ewald ewald(6.5, 0.5, 80.0, 20.0);
+    const int nmax = 8;
+    for (int d = 0; d < 3; d++) {
+        auto up = strained(d, h), down = strained(d, -h);
+        const double rec = (ewald.reciprocal_energy(up.first, charges, dipoles, up.second, nmax) -
+                            ewald.reciprocal_energy(down.first, charges, dipoles, down.second, nmax)) /
+                           (2.0 * h);
+        CHECK(ewald.reciprocal_virial(positions, charges, dipoles, L, nmax)(d, d) == Approx(-rec).epsilon(1e-5));
+        const double sur = (ewald.surface_energy(up.first, charges, dipoles, up.second.prod()) -
+                            ewald.surface_energy(down.first, charges, dipoles, down.second.prod())) /
+                           (2.0 * h);
+        CHECK(ewald.surface_virial(positions, charges, dipoles, L.prod())(d, d) == Approx(-sur).epsilon(1e-5));
+    }
+
+    // the antisymmetric part of the reciprocal virial balances the reciprocal-space torques
+    ParticleMeshEwald pme(0.5, L, {32, 32, 32}, 8, 20.0);
+    pme.update(positions, charges, dipoles);
+    vec3 torque = vec3::Zero();
+    for (auto &t : pme.torques())
+        torque += t;
+    const vec3 axial = torque_axial(ewald.reciprocal_virial(positions, charges, dipoles, L, nmax));
+    CHECK((axial + torque).norm() < 1e-4 * torque.norm());
+}
+
+TEST_CASE("[CoulombGalore] SystemDipole") {
+    using doctest::Approx;
+    const size_t N = 20;
+    const double volume = 1000.0;
+    std::vector<vec3> positions(N), dipoles(N);
+    std::vector<double> charges(N);
+    srand(3);
+    for (size_t i = 0; i < N; i++) {
+        positions[i] = 5.0 * vec3::Random();
+        dipoles[i] = vec3::Random();
+        charges[i] = (i % 2 == 0) ? 1.0 : -1.0;
+    }
+    Ewald ewald(5.0, 0.4, 10.0);
+    EwaldT ewaldt(5.0, 0.4, 10.0);
+    SystemDipole M(positions, charges, dipoles);
+    CHECK(M.moment().isApprox(SystemDipole(positions, charges, dipoles).moment()));
+    CHECK(ewald.surface_energy(M, volume) == Approx(ewald.surface_energy(positions, charges, dipoles, volume)));
+
+    for (int step = 0; step < 200; step++) {
+        const size_t i = step % N;
+        const vec3 new_position = positions[i] + vec3::Random();
+        const vec3 new_dipole = vec3::Random();
+        M.propose(charges[i], positions[i], new_position, dipoles[i], new_dipole);
+        CHECK(M.pending());
+
+        auto trial_positions = positions;
+        auto trial_dipoles = dipoles;
+        trial_positions[i] = new_position;
+        trial_dipoles[i] = new_dipole;
+        CHECK(ewald.surface_energy_change(M, volume) ==
+              Approx(ewald.surface_energy(trial_positions, charges, trial_dipoles, volume) -
+                     ewald.surface_energy(positions, charges, dipoles, volume)));
+        CHECK(ewaldt.surface_energy_change(M, volume) ==
+              Approx(ewaldt.surface_energy(trial_positions, charges, trial_dipoles, volume) -
+                     ewaldt.surface_energy(positions, charges, dipoles, volume)));
+
+        if (step % 3 == 0)
+            M.reject();
+        else {
+            M.accept();
+            positions = trial_positions;
+            dipoles = trial_dipoles;
+        }
+        CHECK(!M.pending());
+    }
+    CHECK(M.moment().isApprox(SystemDipole(positions, charges, dipoles).moment(), 1e-12));
+    CHECK(ewald.surface_virial(M, volume).isApprox(ewald.surface_virial(positions, charges, dipoles, volume)));
+
+    // insertion and deletion
+    M.propose_insertion(1.0, vec3(1, 2, 3), vec3(0, 0, 1));
+    CHECK(M.trial_moment().isApprox(M.moment() + vec3(1, 2, 4)));
+    M.propose_deletion(1.0, vec3(1, 2, 3), vec3(0, 0, 1));
+    CHECK(M.trial_moment().isApprox(M.moment()));
+    M.reject();
+    CHECK(!M.pending());
+}
+
+TEST_CASE("[CoulombGalore] DielectricEstimator") {
+    using doctest::Approx;
+    SUBCASE("BlockAverage") {
+        // autoregressive process with unit variance and a known error of the mean
+        const double phi = 0.9;
+        const size_t N = 1 << 16;
+        std::mt19937 engine(7);
+        std::normal_distribution<double> normal;
+        BlockAverage average;
+        double x = 0.0, sum = 0.0, sum2 = 0.0;
+        for (size_t n = 0; n < N; n++) {
+            x = phi * x + std::sqrt(1.0 - phi * phi) * normal(engine);
+            average.add(x);
+            sum += x;
+            sum2 += x * x;
+        }
+        CHECK(average.size() == N);
+        CHECK(average.number_of_levels() == 17);
+        CHECK(average.mean() == Approx(sum / N));
+        CHECK(average.variance() == Approx((sum2 - sum * sum / N) / (N - 1)));
+        CHECK(average.error(0) == Approx(std::sqrt(average.variance() / N)));
+        const double exact = std::sqrt((1.0 + phi) / (1.0 - phi) / N);
+        CHECK(average.error() > 3.0 * average.error(0));
+        CHECK(average.error() == Approx(exact).epsilon(0.2));
+        average.clear();
+        CHECK(average.size() == 0);
+        CHECK(average.error() == 0.0);
+    }
+    SUBCASE("Dielectric constant") {
+        const double volume = 500.0, kT = 2.0;
+        const size_t N = 10;
+        std::vector<vec3> positions(N), dipoles(N);
+        std::vector<double> charges(N, 0.0);
+        srand(5);
+        for (auto &mu : dipoles)
+            mu = vec3::Random();
+        SystemDipole M(positions, charges, dipoles);
+        DielectricEstimator estimator(volume, kT);
+        double sum_M2 = 0.0;
+        for (int step = 0; step < 4000; step++) {
+            const size_t i = (step / 2) % N;
+            const vec3 mu = vec3::Random();
+            M.propose(0.0, positions[i], positions[i], dipoles[i], mu);
+            if (step % 2 == 0) {
+                M.accept();
+                dipoles[i] = mu;
+            } else
+                M.reject();
+            estimator.sample(M);
+            sum_M2 += SystemDipole(positions, charges, dipoles).moment().squaredNorm();
+        }
+        Ewald ewald(5.0, 0.4, 40.0);
+        ReactionField rf(5.0, 40.0, 1.0, false);
+        CHECK(estimator.size() == 4000);
+        const double M2V = DielectricEstimator::M2V(sum_M2 / 4000, volume, kT);
+        CHECK(M2V == Approx(4.0 * pi * sum_M2 / 4000 / (3.0 * volume * kT)));
+        CHECK(estimator.M2V() == Approx(M2V));
+        for (const SchemeBase *scheme : std::initializer_list<const SchemeBase *>{&ewald, &rf}) {
+            CHECK(estimator.dielectric(*scheme) == Approx(scheme->calc_dielectric(M2V)));
+            const double x = estimator.M2V(), dx = 1e-6;
+            const double slope = (scheme->calc_dielectric(x + dx) - scheme->calc_dielectric(x - dx)) / (2.0 * dx);
+            CHECK(estimator.dielectric_error(*scheme) == Approx(std::fabs(slope) * estimator.M2V_error()).epsilon(1e-3));
+        }
+        CHECK(estimator.M2V_error() > 0.0);
+        CHECK(estimator.mean_moment().norm() < 4.0 * estimator.mean_moment_error().norm());
+
+        // M2V scales with the volume of each sample
+        DielectricEstimator resized(volume, kT);
+        resized.sample(vec3(1, 0, 0));
+        resized.set_volume(2.0 * volume);
+        resized.sample(vec3(1, 0, 0));
+        CHECK(resized.M2V() == Approx(0.75 * DielectricEstimator::M2V(1.0, volume, kT)));
+        resized.clear();
+        CHECK(resized.size() == 0);
+    }
+}
+
+TEST_CASE("[CoulombGalore] Batch short-range functions") {
+    using doctest::Approx;
+    const double cutoff = 9.0;
+    std::vector<double> q(150);
+    for (size_t i = 0; i < q.size(); i++)
+        q[i] = double(i) / (q.size() - 1); // spans several batches, including both ends
+    auto close = [](double a, double b) { return std::fabs(a - b) < 1e-10 * (1.0 + std::fabs(b)); };
+    auto compare = [&](const SchemeBase &pot) {
+        std::array<std::vector<double>, 4> s;
+        for (auto &v : s)
+            v.resize(q.size());
+        pot.short_range_functions(q.data(), q.size(), s[0].data(), s[1].data(), s[2].data(), s[3].data());
+        for (size_t i = 0; i < q.size(); i++) {
+            CHECK(close(s[0][i], pot.short_range_function(q[i])));
+            CHECK(close(s[1][i], pot.short_range_function_derivative(q[i])));
+            CHECK(close(s[2][i], pot.short_range_function_second_derivative(q[i])));
+            CHECK(close(s[3][i], pot.short_range_function_third_derivative(q[i])));
+        }
+        std::vector<double> dds(q.size(), 0.0); // lower outputs may be skipped
+        pot.short_range_functions(q.data(), q.size(), nullptr, nullptr, dds.data());
+        for (size_t i = 0; i < q.size(); i++)
+            CHECK(close(dds[i], s[2][i]));
+        pot.short_range_functions(q.data(), 0, s[0].data()); // nothing to do
+    };
+    SUBCASE("Plain") { compare(Plain()); }
+    SUBCASE("Ewald") { compare(Ewald(cutoff, 0.3)); }
+    SUBCASE("Ewald screened") { compare(Ewald(cutoff, 0.3, infinity, 12.0)); }
+    SUBCASE("EwaldT") { compare(EwaldT(cutoff, 0.3)); }
+    SUBCASE("Reaction-field") { compare(ReactionField(cutoff, 80.0, 1.0, true)); }
+    SUBCASE("Wolf") { compare(Wolf(cutoff, 0.2)); }
+    SUBCASE("Zahn") { compare(Zahn(cutoff, 0.2)); }
+    SUBCASE("Fennell") { compare(Fennell(cutoff, 0.2)); }
+    SUBCASE("ZeroDipole") { compare(ZeroDipole(cutoff, 0.2)); }
+    SUBCASE("qPotential") {
+        compare(qPotential(cutoff, 3));
+        compare(qPotential(cutoff, 5));
+        compare(qPotentialFixedOrder<5>(cutoff));
+    }
+    SUBCASE("Fanourgakis") { compare(Fanourgakis(cutoff)); }
+    SUBCASE("Poisson") {
+        compare(Poisson(cutoff, 1, -1));
+        compare(Poisson(cutoff, 1, 0));
+        compare(Poisson(cutoff, 3, 3));
+        compare(Poisson(cutoff, 4, 3));
+        compare(Poisson(cutoff, 3, 3, 15.0));
+        compare(Poisson(cutoff, 6, 4));
+        compare(Poisson(cutoff, 12, 11));
+        compare(Poisson(cutoff, 10, 4, 15.0));
+    }
+    SUBCASE("Polynomial") {
+        const Polynomial one_minus_q({1.0, -1.0});
+        const Polynomial p = one_minus_q * one_minus_q * Polynomial({0.0, 2.0});
+        CHECK(p.coefficients() == std::vector<double>({0.0, 2.0, -4.0, 2.0})); // 2q(1-q)^2
+        CHECK(p.coefficients(3) == std::vector<double>({12.0}));
+        CHECK(p(0.5) == Approx(0.25));
+        CHECK(p(0.5, 1) == Approx(2.0 - 8.0 * 0.5 + 6.0 * 0.25));
+        CHECK(Polynomial({3.0}).coefficients(1) == std::vector<double>({0.0}));
+    }
+}
+
+TEST_CASE("[CoulombGalore] SchemeCache") {
+#ifdef NLOHMANN_JSON_HPP
+    using doctest::Approx;
+    SchemeCache cache;
+    const nlohmann::json ewald = {{"type", "ewald"}, {"cutoff", 10}, {"alpha", 0.3}};
+    auto a = cache.get(ewald);
+    auto b = cache.get({{"alpha", 0.30}, {"cutoff", 10.0}, {"type", "ewald"}}); // same parameters
+    auto c = cache.get({{"type", "ewald"}, {"cutoff", 10}, {"alpha", 0.4}});
+    CHECK(a == b);
+    CHECK(a != c);
+    CHECK(cache.size() == 2);
+    CHECK(cache.statistics() == std::make_pair(size_t(1), size_t(2)));
+    CHECK(cache.number_of_inputs() == 3);
+    CHECK(cache.get(ewald) == a); // same input, not canonicalized again
+    CHECK(cache.number_of_inputs() == 3);
+    CHECK(cache.statistics() == std::make_pair(size_t(2), size_t(2)));
+    CHECK(a->ion_potential(1.0, 5.0) == Approx(Ewald(10.0, 0.3).ion_potential(1.0, 5.0)));
+
+    // invalid input is not cached
+    CHECK_THROWS(cache.get({{"type", "nonsense"}}));
+    CHECK_THROWS(cache.get({{"type", "ewald"}, {"cutoff", 10}}));
+    CHECK(cache.size() == 2);
+    CHECK(cache.number_of_inputs() == 3);
+
+    // splined schemes are built once and shared by concurrent requests
+    const nlohmann::json spline = {{"type", "spline"}, {"scheme", {{"type", "qpotential"}, {"cutoff", 12}, {"order", 4}}}};
+    std::vector<std::shared_ptr<const SchemeBase>> splined(8);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < splined.size(); i++)
+        threads.emplace_back([&, i] { splined[i] = cache.get(spline); });
+    for (auto &t : threads)
+        t.join();
+    for (auto &s : splined)
+        CHECK(s == splined.front());
+    CHECK(cache.size() == 3);
+    CHECK(dynamic_cast<const Splined *>(splined.front().get()) != nullptr);
+    CHECK(splined.front()->ion_potential(1.0, 5.0) == Approx(qPotential(12.0, 4).ion_potential(1.0, 5.0)).epsilon(1e-3));
+    CHECK(cache.get({{"type", "spline"}, {"tolerance", 1e-3}, {"scheme", {{"type", "qpotential"}, {"cutoff", 12.0}, {"order", 4}}}}) ==
+          splined.front());
+    CHECK(cache.get({{"type", "spline"}, {"tolerance", 1e-4}, {"scheme", {{"type", "qpotential"}, {"cutoff", 12.0}, {"order", 4}}}}) !=
+          splined.front());
+
+    cache.clear();
+    CHECK(cache.size() == 0);
+    CHECK(cache.number_of_inputs() == 0);
+    CHECK(a->ion_potential(1.0, 5.0) == Approx(Ewald(10.0, 0.3).ion_potential(1.0, 5.0))); // still valid
+    CHECK(scheme_cache().get(ewald) == scheme_cache().get(ewald));
+#endif
+}
+
+TEST_CASE("[CoulombGalore] InteractionMatrix") {
+    using doctest::Approx;
+    const size_t N = 90;
+    const double side = 24.0;
+    std::vector<vec3> positions(N), dipoles(N);
+    std::vector<double> charges(N);
+    std::vector<int> types(N);
+    srand(11);
+    for (size_t i = 0; i < N; i++) {
+        positions[i] = 0.5 * side * (vec3::Random() + vec3::Ones());
+        types[i] = i % 3; // 0 = cations, 1 = anions, 2 = neutral dipoles
+        charges[i] = (types[i] == 0) ? 1.0 : (types[i] == 1 ? -1.0 : 0.0);
+        dipoles[i] = (types[i] == 2) ? vec3(0.6 * vec3::Random()) : vec3::Zero();
+    }
+    const OrthorhombicBox box(side);
+    const Ewald ewald(10.0, 0.3);
+    const ReactionField rf(7.0, 80.0, 1.0, true);
+    const qPotential qpot(8.0, 3);
+
+    InteractionMatrix<OrthorhombicBox> matrix(3, box);
+    matrix.set(0, 0, ewald);
+    matrix.set(0, 1, ewald);
+    matrix.set(1, 1, ewald);
+    matrix.set(2, 0, qpot);
+    matrix.set(2, 2, rf); // types 1 and 2 do not interact
+    CHECK(matrix.scheme(0, 2) == matrix.scheme(2, 0));
+    CHECK(matrix.scheme(1, 2) == nullptr);
+    CHECK(matrix.cutoff(2, 2) == Approx(7.0));
+    CHECK(matrix.cutoff(1, 2) == 0.0);
+    CHECK(matrix.max_cutoff() == Approx(10.0));
+    CHECK_THROWS(matrix.set(1, 2, Ewald(13.0, 0.3))); // cutoff beyond half the box
+
+    const auto pairs = all_pairs(N);
+    std::vector<PairList> buckets;
+    matrix.bucket(types, pairs, buckets);
+    size_t total = 0;
+    for (auto &b : buckets)
+        total += b.size();
+    CHECK(total == pairs.size());
+
+    // reference: one driver per type pair on the filtered list
+    auto filtered = [&](int a, int b) {
+        PairList list;
+        for (auto &p : pairs) {
+            const int ta = types[p[0]], tb = types[p[1]];
+            if ((ta == a && tb == b) || (ta == b && tb == a))
+                list.push_back(p);
+        }
+        return list;
+    };
+    PairAccumulator reference;
+    reference.forces.assign(N, vec3::Zero());
+    reference.torques.assign(N, vec3::Zero());
+    PairDriver<Ewald, OrthorhombicBox> ewald_driver(ewald, box);
+    for (auto ab : std::vector<std::array<int, 2>>{{0, 0}, {0, 1}, {1, 1}})
+        ewald_driver.accumulate(positions, charges, dipoles, filtered(ab[0], ab[1]), reference, true);
+    PairDriver<qPotential, OrthorhombicBox>(qpot, box).accumulate(positions, charges, dipoles, filtered(0, 2), reference, true);
+    PairDriver<ReactionField, OrthorhombicBox>(rf, box).accumulate(positions, charges, dipoles, filtered(2, 2), reference, true);
+
+    auto result = matrix.compute(positions, charges, dipoles, types, pairs, true);
+    CHECK(result.energy == Approx(reference.energy));
+    CHECK(result.pairs_in_cutoff == reference.pairs_in_cutoff);
+    CHECK((result.virial - reference.virial).norm() == Approx(0.0).epsilon(1e-10));
+    for (size_t i = 0; i < N; i++) {
+        CHECK((result.forces[i] - reference.forces[i]).norm() == Approx(0.0).epsilon(1e-10));
+        CHECK((result.torques[i] - reference.torques[i]).norm() == Approx(0.0).epsilon(1e-10));
+    }
+
+    // the scratch buckets are refilled on each call
+    const PairList half(pairs.begin(), pairs.begin() + pairs.size() / 2);
+    const double u_half = InteractionMatrix<OrthorhombicBox>(matrix).compute(positions, charges, dipoles, types, half).energy;
+    CHECK(matrix.compute(positions, charges, dipoles, types, half).energy == Approx(u_half));
+    CHECK(matrix.compute(positions, charges, dipoles, types, pairs).energy == Approx(result.energy));
+
+    // concurrent calls on the same instance use scratch of their own thread
+    const auto &shared = matrix;
+    std::vector<double> energies(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < energies.size(); t++)
+        threads.emplace_back([&, t] {
+            std::vector<PairList> local;
+            shared.bucket(types, pairs, local);
+            energies[t] = shared.compute(positions, charges, dipoles, types, t % 2 ? half : pairs).energy;
+        });
+    for (auto &thread : threads)
+        thread.join();
+    for (size_t t = 0; t < energies.size(); t++)
+        CHECK(energies[t] == Approx(t % 2 ? u_half : result.energy));
+
+    // copies are independent
+    InteractionMatrix<OrthorhombicBox> copy = matrix;
+    copy.unset(2, 2);
+    CHECK(matrix.scheme(2, 2) != nullptr);
+    CHECK(copy.compute(positions, charges, dipoles, types, pairs).energy != Approx(result.energy));
+    copy.set_box(OrthorhombicBox(2.0 * side));
+    CHECK(copy.cell().inscribed_radius() == Approx(side));
+}
+
+TEST_CASE("[CoulombGalore] Shifted") {
+    using doctest::Approx;
+    double cutoff = 18.0;
+    vec3 r = {10.0, 4.0, 3.0};
+    vec3 mu = {0.2, -1.1, 0.7};
+
+    SUBCASE("Plain becomes Poisson C=1, D=1") {
+        Shifted<Poisson> pot(Poisson(cutoff, 1, -1));
+        Poisson ref(cutoff, 1, 1);
+        for (double q : {0.0, 0.2, 0.5, 0.9}) {
+            CHECK(pot.short_range_function(q) == Approx(ref.short_range_function(q)));
+            CHECK(pot.short_range_function_derivative(q) == Approx(ref.short_range_function_derivative(q)));
+            CHECK(pot.short_range_function_second_derivative(q) ==
+                  Approx(ref.short_range_function_second_derivative(q)));
+        }
+        CHECK(pot.ion_ion_energy(1.0, -1.0, r.norm()) == Approx(ref.ion_ion_energy(1.0, -1.0, r.norm())));
+        CHECK(pot.self_energy({4.0, 0.0, 0.0}) == Approx(ref.self_energy({4.0, 0.0, 0.0})));
+        CHECK(pot.calc_dielectric(1.0) == Approx(ref.calc_dielectric(1.0)));
+        CHECK(pot.neutralization_energy({1.0}, 1000.0) == Approx(ref.neutralization_energy({1.0}, 1000.0)));
+    }
+
+    SUBCASE("Energy and force vanish at the cutoff") {
+        Shifted<qPotential> qpot(qPotential(cutoff, 2));
+        Shifted<Wolf> wolf(Wolf(cutoff, 0.1));
+        Shifted<ReactionField> rf(ReactionField(cutoff, 80.0, 1.0, false));
+        vec3 rc = (1.0 - 1e-8) * cutoff * r.normalized();
+        for (const SchemeBase *pot : std::vector<const SchemeBase *>{&qpot, &wolf, &rf}) {
+            CHECK(pot->short_range_function(1.0) == Approx(0.0));
+            CHECK(pot->short_range_function_derivative(1.0) == Approx(0.0));
+            CHECK(std::fabs(pot->ion_ion_energy(1.0, 1.0, rc.norm())) < 1e-9);
+            CHECK(pot->ion_ion_force(1.0, 1.0, rc).norm() < 1e-9);
+            CHECK(std::fabs(pot->ion_dipole_energy(1.0, mu, rc)) < 1e-9);
+        }
+        // screened: the exponential factor keeps both zero
+        Shifted<Poisson> yukawa(Poisson(cutoff, 2, 1, 23.0));
+        CHECK(std::fabs(yukawa.ion_ion_energy(1.0, 1.0, rc.norm())) < 1e-9);
+        CHECK(yukawa.ion_ion_force(1.0, 1.0, rc).norm() < 1e-9);
+    }
+
+    SUBCASE("Combined and batch evaluation") {
+        Shifted<Ewald> pot(Ewald(cutoff, 0.1));
+        std::vector<double> q = {0.05, 0.3, 0.6, 0.95}, s(4), ds(4), dds(4), ddds(4);
+        pot.short_range_functions(q.data(), q.size(), s.data(), ds.data(), dds.data(), ddds.data());
+        for (size_t i = 0; i < q.size(); i++) {
+            std::array<double, 4> v;
+            pot.short_range_function_and_derivatives<3>(q[i], v);
+            CHECK(v[0] == Approx(pot.short_range_function(q[i])));
+            CHECK(v[1] == Approx(pot.short_range_function_derivative(q[i])));
+            CHECK(v[2] == Approx(pot.short_range_function_second_derivative(q[i])));
+            CHECK(v[3] == Approx(pot.short_range_function_third_derivative(q[i])));
+            CHECK(s[i] == Approx(v[0]));
+            CHECK(ds[i] == Approx(v[1]));
+            CHECK(dds[i] == Approx(v[2]));
+            CHECK(ddds[i] == Approx(v[3]));
+        }
+        CHECK(pot.unshifted().name == "Ewald real-space");
+        CHECK(pot.name == "Ewald real-space shifted");
+    }
+}
+
+TEST_CASE("[CoulombGalore] Compile-time screening") {
+    using doctest::Approx;
+    static_assert(!Fanourgakis::screened && !qPotential::screened && !Wolf::screened, "unscreened schemes");
+    static_assert(Poisson::screened && Ewald::screened && Plain::screened, "screened schemes");
+    static_assert(!Shifted<ReactionField>::screened && Shifted<Poisson>::screened, "policy of wrapped scheme");
+
+    double cutoff = 18.0;
+    vec3 r = {5.0, -2.0, 3.0};
+    vec3 muA = {0.3, 1.2, -0.4}, muB = {-1.0, 0.2, 0.5};
+    mat33 quad;
+    quad << 1.0, 0.2, 0.1, 0.2, -0.5, 0.3, 0.1, 0.3, -0.5;
+
+    Fanourgakis pot(cutoff);       // kr terms removed at compile time
+    Poisson ref(cutoff, 4, 3);     // same short-range function; kr = 0 at run time
+    auto f = pot.pair_factors<3>(r.squaredNorm());
+    CHECK(f.kr == 0.0);
+    CHECK(f.expkr == 1.0);
+    CHECK(ref.pair_factors<3>(r.squaredNorm()).expkr == 1.0);
+
+    CHECK(pot.ion_potential(1.0, r.norm()) == Approx(ref.ion_potential(1.0, r.norm())));
+    CHECK(pot.dipole_potential(muA, r) == Approx(ref.dipole_potential(muA, r)));
+    CHECK(pot.quadrupole_potential(quad, r) == Approx(ref.quadrupole_potential(quad, r)));
+    CHECK((pot.ion_field(1.0, r) - ref.ion_field(1.0, r)).norm() < 1e-12);
+    CHECK((pot.dipole_field(muA, r) - ref.dipole_field(muA, r)).norm() < 1e-12);
+    CHECK((pot.quadrupole_field(quad, r) - ref.quadrupole_field(quad, r)).norm() < 1e-12);
+    CHECK((pot.multipole_field(1.0, muA, quad, r) - ref.multipole_field(1.0, muA, quad, r)).norm() < 1e-12);
+    CHECK((pot.dipole_dipole_force(muA, muB, r) - ref.dipole_dipole_force(muA, muB, r)).norm() < 1e-12);
+    CHECK(pot.multipole_multipole_energy(1.0, -1.0, muA, muB, quad, quad, r) ==
+          Approx(ref.multipole_multipole_energy(1.0, -1.0, muA, muB, quad, quad, r)));
+    CHECK((pot.multipole_multipole_force(1.0, -1.0, muA, muB, quad, quad, r) -
+           ref.multipole_multipole_force(1.0, -1.0, muA, muB, quad, quad, r))
+              .norm() < 1e-12);
+    auto p = pot.interaction<3>(r), p_ref = ref.interaction<3>(r);
+    CHECK(p.force_indirect == Approx(p_ref.force_indirect));
+    CHECK(p.dipole_isotropic == Approx(p_ref.dipole_isotropic));
+}
+
+TEST_CASE("[CoulombGalore] RadialTable") {
+    using doctest::Approx;
+    const double cutoff = 12.0, rmin = 1.2;
+    const vec3 muA = {1.9, 0.7, 1.1}, muB = {1.3, -1.7, 0.5};
+    mat33 quad;
+    quad << 1.0, 0.2, 0.1, 0.2, -0.5, 0.3, 0.1, 0.3, -0.5;
+
+    SUBCASE("Quadrupole factors of PairInteraction") {
+        Ewald pot(cutoff, 0.2, infinity, 23.0);
+        for (vec3 r : {vec3(2.3, 0, 0), vec3(5, -3, 6), vec3(1, 2, 0.5)}) {
+            auto pair = pot.interaction<3>(r);
+            CHECK(pair.quadrupole_potential(quad) == Approx(pot.quadrupole_potential(quad, r)));
+            CHECK((pair.quadrupole_field(quad) - pot.quadrupole_field(quad, r)).norm() <
+                  1e-12 * pot.quadrupole_field(quad, r).norm());
+        }
+    }
+
+    auto check = [&](const auto &pot) {
+        RadialTable<std::decay_t<decltype(pot)>> table(pot, rmin);
+        CHECK(table.size() == 2048);
+        std::mt19937 engine(1);
+        std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+        for (int i = 0; i < 200; i++) {
+            vec3 r(uniform(engine), uniform(engine), uniform(engine));
+            r *= (4.0 * rmin + (cutoff - 4.0 * rmin) * 0.5 * (1.0 + uniform(engine))) / r.norm();
+            auto exact = pot.template interaction<3>(r), tabulated = table.interaction(r);
+            const double r1 = r.norm(), r3 = r1 * r1 * r1; // compare to the unscreened Coulomb factors
+            CHECK(std::fabs(tabulated.potential - exact.potential) < 1e-9 / r1);
+            CHECK(std::fabs(tabulated.field - exact.field) < 1e-9 / r3);
+            CHECK(std::fabs(tabulated.dipole_direct - exact.dipole_direct) < 1e-9 / r3);
+            CHECK(std::fabs(tabulated.dipole_isotropic - exact.dipole_isotropic) < 1e-9 / r3);
+            CHECK(std::fabs(tabulated.force_direct - exact.force_direct) < 1e-9 / (r3 * r1 * r1));
+            CHECK(std::fabs(tabulated.force_indirect - exact.force_indirect) < 1e-9 / (r3 * r3 * r1));
+            CHECK((tabulated.dipole_dipole_force(muA, muB) - exact.dipole_dipole_force(muA, muB)).norm() <
+                  1e-8 / (r3 * r1));
+        }
+        // closest tabulated distance and the end of the grid
+        for (double d : {rmin * 1.0001, 0.5 * (rmin + cutoff), cutoff * 0.9999})
+            CHECK(std::fabs(table.interaction(vec3(0, d, 0)).field - pot.template interaction<3>(vec3(0, d, 0)).field) <
+                  1e-6 / (d * d * d));
+        // evaluated exactly below rmin and zero beyond the cutoff
+        vec3 r(0.3, 0.4, 0.2);
+        CHECK(table.interaction(r).force_indirect == pot.template interaction<3>(r).force_indirect);
+        CHECK(table.interaction(vec3(cutoff, 0, 0)).potential == 0.0);
+        CHECK(table.interaction(vec3(cutoff + 1, 0, 0)).dipole_dipole_energy(muA, muB) == 0.0);
+    };
+    check(Ewald(cutoff, 0.2, infinity, 23.0));
+    check(qPotential(cutoff, 3));
+    check(ReactionField(cutoff, 80.0, 1.0, true));
+    CHECK_THROWS(RadialTable<qPotential>(qPotential(cutoff, 3), cutoff));
+}
+
+TEST_CASE("[CoulombGalore] Bulk self-energy and neutralization") {
+    using doctest::Approx;
+    const double cutoff = 12.0, volume = 20000.0;
+    const std::vector<double> charges = {1.0, -2.0, 0.5, 0.0, 1.5};
+    const std::vector<vec3> dipoles = {{0.1, 0.2, 0.3}, {0, 0, 0}, {1.0, -0.5, 0.2}, {0.3, 0.3, -0.9}, {0, 1, 0}};
+
+    Ewald pot(cutoff, 0.25);
+    double reference = 0.0, reference_charges = 0.0;
+    for (size_t i = 0; i < charges.size(); i++) {
+        reference += pot.self_energy({charges[i] * charges[i], dipoles[i].squaredNorm(), 0.0});
+        reference_charges += pot.self_energy({charges[i] * charges[i], 0.0, 0.0});
+    }
+    CHECK(pot.self_energy({4.0, 2.0, 0.0}) == Approx(pot.selfEnergyFunctor({4.0, 2.0})));
+    const std::array<double, 2> moments = {4.0, 2.0}; // two-element form from before quadrupoles
+    CHECK(pot.self_energy(moments) == Approx(pot.self_energy({4.0, 2.0, 0.0})));
+    struct Custom : public Ewald {
+        Custom() : Ewald(10.0, 0.3) {
+            const std::array<double, 2> factor = {-1.0, -2.0};
+            setSelfEnergyPrefactor(factor);
+        }
+    };
+    CHECK(Custom().self_energy({1.0, 1.0, 1.0}) == Approx(-1.0 / 10.0 - 2.0 / 1000.0));
+    CHECK(pot.self_energy_sum(charges, dipoles) == Approx(reference));
+    CHECK(pot.self_energy_sum(charges) == Approx(reference_charges));
+    CHECK(pot.self_energy_sum(charges.data(), nullptr, charges.size()) == Approx(reference_charges));
+
+    // incremental update of two particles
+    std::vector<double> new_charges = charges;
+    std::vector<vec3> new_dipoles = dipoles;
+    new_charges[1] = -1.0;
+    new_dipoles[3] = {0.0, 0.0, 2.0};
+    const std::vector<size_t> moved = {1, 3};
+    double change = pot.self_energy_sum(new_charges, new_dipoles, moved) - pot.self_energy_sum(charges, dipoles, moved);
+    CHECK(pot.self_energy_sum(charges, dipoles) + change == Approx(pot.self_energy_sum(new_charges, new_dipoles)));
+
+    // the compensating energy depends on the squared net charge
+    Poisson plain(cutoff, 1, -1); // chi = -2 pi Rc^2
+    CHECK(plain.neutralization_energy(charges, volume) == Approx(-pi * cutoff * cutoff / volume * 1.0));
+    CHECK(plain.neutralization_energy(2.0, volume) == Approx(-pi * cutoff * cutoff / volume * 4.0));
+    CHECK(plain.neutralization_energy(new_charges, volume) == Approx(plain.neutralization_energy(2.0, volume)));
+    const double eta = 0.25 * cutoff; // chi = -pi Rc^2 / eta^2 without screening
+    CHECK(std::isfinite(pot.neutralization_energy(1.0, volume)));
+    CHECK(pot.neutralization_energy(1.0, volume) == Approx(-pi * cutoff * cutoff / (2.0 * volume * eta * eta)));
+    CHECK(pot.neutralization_energy(-2.0, volume) == Approx(4.0 * pot.neutralization_energy(1.0, volume)));
+    const Ewald screened(cutoff, 0.25, infinity, 20.0), weakly_screened(cutoff, 0.25, infinity, 2000.0);
+    CHECK(std::isfinite(screened.neutralization_energy(1.0, volume)));
+    CHECK(screened.neutralization_energy(1.0, volume) < 0.0);
+    CHECK(weakly_screened.neutralization_energy(1.0, volume) == Approx(pot.neutralization_energy(1.0, volume)).epsilon(1e-3));
+    CHECK(pot.neutralization_energy(std::vector<double>{1.0, -1.0}, volume) == 0.0);
+    const SchemeBase &base = pot;
+    CHECK(base.neutralization_energy(charges, volume) == Approx(pot.neutralization_energy(1.0, volume)));
+}
+
+TEST_CASE("[CoulombGalore] Multiple time-step split") {
+    using doctest::Approx;
+    const double cutoff = 12.0, inner_cutoff = 6.0, width = 1.5;
+    const vec3 muA = {1.9, 0.7, 1.1}, muB = {1.3, -1.7, 0.5};
+    mat33 quad;
+    quad << 1.0, 0.2, 0.1, 0.2, -0.5, 0.3, 0.1, 0.3, -0.5;
+    typedef Switched<Ewald>::Part Part;
+    Ewald pot(cutoff, 0.2, infinity, 23.0);
+    Switched<Ewald> inner(pot, inner_cutoff, width, Part::inner), outer(pot, inner_cutoff, width, Part::outer);
+    CHECK(inner.cutoff == inner_cutoff);
+    CHECK(outer.cutoff == cutoff);
+    CHECK(inner.name == "Ewald real-space inner");
+
+    SUBCASE("Parts add up to the scheme") {
+        for (double d : {2.0, 4.6, 5.2, 5.9, 8.0, 11.5}) {
+            const vec3 r = d * vec3(0.48, 0.6, 0.64);
+            CHECK(inner.ion_potential(1.0, d) + outer.ion_potential(1.0, d) == Approx(pot.ion_potential(1.0, d)));
+            CHECK((inner.ion_field(1.0, r) + outer.ion_field(1.0, r) - pot.ion_field(1.0, r)).norm() <
+                  1e-12 * pot.ion_field(1.0, r).norm());
+            CHECK((inner.dipole_field(muA, r) + outer.dipole_field(muA, r) - pot.dipole_field(muA, r)).norm() <
+                  1e-12 * pot.dipole_field(muA, r).norm());
+            CHECK((inner.dipole_dipole_force(muA, muB, r) + outer.dipole_dipole_force(muA, muB, r) -
+                   pot.dipole_dipole_force(muA, muB, r))
+                      .norm() < 1e-12 * pot.dipole_dipole_force(muA, muB, r).norm());
+            CHECK((inner.multipole_multipole_force(1.0, -1.0, muA, muB, quad, quad, r) +
+                   outer.multipole_multipole_force(1.0, -1.0, muA, muB, quad, quad, r) -
+                   pot.multipole_multipole_force(1.0, -1.0, muA, muB, quad, quad, r))
+                      .norm() < 1e-12 * pot.multipole_multipole_force(1.0, -1.0, muA, muB, quad, quad, r).norm());
+        }
+        for (auto m : std::vector<std::array<double, 3>>{{4.0, 0.0, 0.0}, {0.0, 2.0, 0.0}, {0.0, 0.0, 3.0}})
+            CHECK(inner.self_energy(m) + outer.self_energy(m) == Approx(pot.self_energy(m)));
+    }
+
+    SUBCASE("Switching region") {
+        CHECK(outer.ion_potential(1.0, inner_cutoff - width - 0.01) == 0.0);
+        CHECK(inner.ion_potential(1.0, inner_cutoff + 0.01) == 0.0);
+        CHECK(inner.ion_potential(1.0, 4.0) == Approx(pot.ion_potential(1.0, 4.0)));
+        // derivatives agree with finite differences, also inside the switching region
+        const double h = 1e-5;
+        for (double q : {0.5, 0.8, 0.85, 0.95}) {
+            CHECK(inner.short_range_function_derivative(q) ==
+                  Approx((inner.short_range_function(q + h) - inner.short_range_function(q - h)) / (2 * h)).epsilon(1e-6));
+            CHECK(inner.short_range_function_second_derivative(q) ==
+                  Approx((inner.short_range_function_derivative(q + h) - inner.short_range_function_derivative(q - h)) /
+                         (2 * h)).epsilon(1e-6));
+            CHECK(inner.short_range_function_third_derivative(q) ==
+                  Approx((inner.short_range_function_second_derivative(q + h) -
+                          inner.short_range_function_second_derivative(q - h)) /
+                         (2 * h)).epsilon(1e-5));
+        }
+        // smooth: force and its derivative are continuous at both ends of the switch
+        for (double d : {inner_cutoff - width, inner_cutoff})
+            CHECK(std::fabs(inner.ion_ion_force(1.0, 1.0, vec3(d + 1e-7, 0, 0)).x() -
+                            inner.ion_ion_force(1.0, 1.0, vec3(d - 1e-7, 0, 0)).x()) < 1e-8);
+        // batch evaluation
+        std::vector<double> q = {0.1, 0.5, 0.8, 0.9, 0.99}, s(5), ds(5), dds(5), ddds(5);
+        inner.short_range_functions(q.data(), q.size(), s.data(), ds.data(), dds.data(), ddds.data());
+        for (size_t i = 0; i < q.size(); i++) {
+            CHECK(s[i] == Approx(inner.short_range_function(q[i])));
+            CHECK(ds[i] == Approx(inner.short_range_function_derivative(q[i])));
+            CHECK(dds[i] == Approx(inner.short_range_function_second_derivative(q[i])));
+            CHECK(ddds[i] == Approx(inner.short_range_function_third_derivative(q[i])));
+        }
+        CHECK_THROWS(Switched<Ewald>(pot, inner_cutoff, inner_cutoff, Part::inner));
+        CHECK_THROWS(Switched<Ewald>(pot, 2.0 * cutoff, width, Part::outer));
+    }
+
+    SUBCASE("Force evaluators") {
+        const size_t N = 60;
+        const double side = 30.0;
+        std::mt19937 engine(3);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        std::vector<vec3> positions(N), dipoles(N);
+        std::vector<double> charges(N);
+        for (size_t i = 0; i < N; i++) {
+            positions[i] = side * vec3(uniform(engine), uniform(engine), uniform(engine));
+            dipoles[i] = vec3(uniform(engine), uniform(engine), uniform(engine)) - vec3::Constant(0.5);
+            charges[i] = i % 2 == 0 ? 1.0 : -1.0;
+        }
+        OrthorhombicBox box(side);
+        MultipleTimeStep<Ewald, OrthorhombicBox> mts(pot, inner_cutoff, width, box);
+        const auto pairs = all_pairs(N);
+        const auto inner_pairs = mts.inner().compact(positions, pairs);
+        CHECK(inner_pairs.size() < pairs.size());
+        auto fast = mts.inner_forces(positions, charges, dipoles, inner_pairs, true);
+        auto slow = mts.outer_forces(positions, charges, dipoles, pairs, true);
+        auto full = PairDriver<Ewald, OrthorhombicBox>(pot, box).compute(positions, charges, dipoles, pairs, true);
+        CHECK(fast.energy + slow.energy == Approx(full.energy));
+        CHECK((fast.virial + slow.virial - full.virial).norm() < 1e-10 * full.virial.norm());
+        for (size_t i = 0; i < N; i++) {
+            CHECK((fast.forces[i] + slow.forces[i] - full.forces[i]).norm() < 1e-10 * (1.0 + full.forces[i].norm()));
+            CHECK((fast.torques[i] + slow.torques[i] - full.torques[i]).norm() < 1e-10 * (1.0 + full.torques[i].norm()));
+        }
+    }
 }